@@ -0,0 +1,85 @@
+// Minimal Arduino API for building the firmware as a Linux program.
+// Time is simulated, see sim.h. Serial output goes to stdout.
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binary.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+
+#define PROGMEM
+class __FlashStringHelper;  // Strings stay in RAM, the type keeps F() calls apart
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define memcpy_P memcpy
+
+#define lowByte(w) ((uint8_t)((w) & 0xFF))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void noInterrupts();
+void interrupts();
+
+class SimSerial {
+ public:
+  void begin(long baud);
+  void end() {}
+  void flush() {}
+  int available();
+  int read();
+  int availableForWrite() { return 63; }
+  size_t write(uint8_t b);
+  size_t write(const uint8_t *buf, size_t len);
+
+  void print(const char *s);
+  void print(const __FlashStringHelper *s) { print(reinterpret_cast<const char *>(s)); }
+  void print(char c);
+  void print(unsigned char n, int base = DEC) { print((unsigned long)n, base); }
+  void print(int n, int base = DEC) { print((long)n, base); }
+  void print(unsigned int n, int base = DEC) { print((unsigned long)n, base); }
+  void print(long n, int base = DEC);
+  void print(unsigned long n, int base = DEC);
+  void print(double d, int digits = 2);
+
+  template <typename T>
+  void println(T v) { print(v); println(); }
+  template <typename T>
+  void println(T v, int fmt) { print(v, fmt); println(); }
+  void println();
+
+  long baud;            // Last rate passed to begin()
+  unsigned long sent;   // Bytes written with write()
+};
+
+extern SimSerial Serial;
+
+#endif
@@ -0,0 +1,787 @@
+// Model of an ATAPI CD-ROM drive at register level. Answers the ATA commands
+// the firmware uses (reset, diagnostics, IDENTIFY PACKET DEVICE, PACKET) and
+// the packet commands TEST UNIT READY, REQUEST SENSE, READ TOC, READ
+// SUB-CHANNEL, MODE SENSE, START STOP UNIT, PLAY AUDIO MSF, PAUSE/RESUME,
+// STOP PLAY, SEEK and READ CD. Busy times follow a mid-90s 8x drive.
+//
+// A master and optionally a slave share the cable. Both take writes to the task
+// file, the DEV bit of the Device/Head register decides which one executes
+// commands, answers reads and drives INTRQ.
+
+#include <stdio.h>
+#include <vector>
+#include "sim.h"
+
+// Register numbers, see ide_reg_decode()
+const int R_DATA = 0;
+const int R_ERROR = 1;    // Features on write
+const int R_SECCNT = 2;   // Interrupt reason on read
+const int R_SECNUM = 3;
+const int R_CYLL = 4;     // Byte count
+const int R_CYLH = 5;
+const int R_HEAD = 6;
+const int R_STATUS = 7;   // Command on write
+const int R_ALTSTAT = 14; // Device control on write
+
+// Status bits
+const uint8_t ST_BSY = 0x80;
+const uint8_t ST_DRDY = 0x40;
+const uint8_t ST_DSC = 0x10;
+const uint8_t ST_DRQ = 0x08;
+const uint8_t ST_ERR = 0x01;
+
+// Timing in microseconds
+const uint64_t T_RESET = 100000;
+const uint64_t T_PACKET_DRQ = 50;      // PACKET opcode until DRQ for the packet, accelerated DRQ
+const uint64_t T_CMD = 300;            // Decoding a packet
+const uint64_t T_BLOCK = 100;          // Between two DRQ blocks
+const uint64_t T_TRAY = 1500000;       // Tray in or out
+const uint64_t T_SPINUP = 1800000;
+const uint64_t T_SPINDOWN = 300000;
+const uint64_t T_SEEK_MIN = 40000;     // Seek to a neighbouring track
+const uint64_t T_ON_SPOT = 8000;       // Pickup already there, half a revolution on average
+const uint64_t T_SEEK_FULL = 250000;   // Seek across the whole disc
+const int SPEED = 8;                   // Read speed for READ CD, times 75 sectors/s
+
+const int CD_RAW = 2352;
+const long DISC_LBAS = 333000;         // 74 minutes
+
+// Audio status codes of READ SUB-CHANNEL
+const uint8_t AS_PLAY = 0x11;
+const uint8_t AS_PAUSE = 0x12;
+const uint8_t AS_DONE = 0x13;
+const uint8_t AS_NONE = 0x15;
+
+enum Phase { IDLE, BUSY, PACKET, DATA_IN };
+enum Next { N_PACKET, N_BLOCK, N_DONE, N_RESET };
+
+struct AtapiDrive {
+  bool present;
+  uint8_t error, features, seccnt, secnum, cyl_l, cyl_h, head, status, devctl;
+  bool intrq;
+
+  Phase phase;
+  Next next;              // What happens when BUSY ends
+  uint64_t busy_until;
+  uint8_t pac[12];
+  int pac_len;
+  std::vector<uint8_t> data;  // Result of the running command
+  size_t data_pos;
+  size_t block_end;
+  unsigned int byte_limit;    // Byte count limit loaded before the command
+  bool check;                 // Command ends with CHECK CONDITION
+  uint8_t key, asc, ascq;     // Sense data of the last CHECK CONDITION
+  uint8_t ua_asc;             // Pending unit attention, 0 if none
+
+  bool tray_open;
+  bool disc;
+  int tracks;
+  long track_lba[100];        // Start of track n at [n - 1], lead-out at [tracks]
+  bool spinning;
+  uint64_t ready_at;          // Spin-up done
+  long head_lba;              // Where the pickup is
+
+  uint8_t audio;              // Audio status
+  long play_from, play_end;   // LBAs of the running PLAY AUDIO
+  uint64_t play_t0;           // When audio output started
+  long pause_lba;
+  uint64_t seek_done;         // The pickup reaches the target of the last PLAY or SEEK
+  std::vector<uint64_t> audio_starts;  // Audio output began, see set_audio()
+
+  unsigned long cmds[256];    // Packet commands received per opcode
+};
+
+static AtapiDrive drives[2];      // Master and slave
+static AtapiDrive *cur = drives;  // The one the helpers below work on
+
+// Helpers
+// #######
+
+static void lba_to_msf(long lba, uint8_t *msf) {
+  lba += 150;
+  msf[0] = lba / (60 * 75);
+  msf[1] = (lba / 75) % 60;
+  msf[2] = lba % 75;
+}
+
+static long msf_to_lba(const uint8_t *msf) {
+  return (msf[0] * 60L + msf[1]) * 75 + msf[2] - 150;
+}
+
+static uint64_t seek_time(long from, long to) {
+  long d = from > to ? from - to : to - from;
+  if (d == 0) {
+    return T_ON_SPOT;
+  }
+  return T_SEEK_MIN + (T_SEEK_FULL - T_SEEK_MIN) * d / DISC_LBAS;
+}
+
+// Current pickup position while playing, ends the PLAY AUDIO at play_end
+static long play_pos() {
+  if (cur->audio != AS_PLAY) {
+    return cur->audio == AS_PAUSE ? cur->pause_lba : cur->head_lba;
+  }
+  long lba = cur->play_from;
+  if (sim_us > cur->play_t0) {
+    lba += (long)((sim_us - cur->play_t0) * 75 / 1000000);
+  }
+  if (lba >= cur->play_end) {
+    lba = cur->play_end;
+    cur->audio = AS_DONE;
+  }
+  cur->head_lba = lba;
+  return lba;
+}
+
+// Change the audio status. Starts of audio output are logged for
+// drive_audio_after(), one still ahead while the drive seeks is taken back
+// if the audio stops before.
+static void set_audio(uint8_t audio, uint64_t t0 = 0) {
+  if (cur->audio == AS_PLAY && cur->play_t0 > sim_us && !cur->audio_starts.empty()) {
+    cur->audio_starts.pop_back();
+  }
+  if (audio == AS_PLAY) {
+    cur->play_t0 = t0;
+    cur->audio_starts.push_back(t0);
+  }
+  cur->audio = audio;
+}
+
+static int track_of(long lba) {
+  int t = 1;
+  while (t < cur->tracks && lba >= cur->track_lba[t]) {
+    t++;
+  }
+  return t;
+}
+
+static void set_signature() {
+  cur->seccnt = 0x01;
+  cur->secnum = 0x01;
+  cur->cyl_l = 0x14;
+  cur->cyl_h = 0xEB;
+}
+
+static void set_busy(uint64_t us, Next next) {
+  cur->phase = BUSY;
+  cur->status = ST_BSY;
+  cur->busy_until = sim_us + us;
+  cur->next = next;
+  cur->intrq = false;
+}
+
+static void raise_intrq() {
+  if (!(cur->devctl & 0x02)) {
+    cur->intrq = true;
+  }
+}
+
+static void fail(uint8_t key, uint8_t asc) {
+  cur->check = true;
+  cur->key = key;
+  cur->asc = asc;
+  cur->ascq = 0;
+  cur->data.clear();
+}
+
+static void complete() {
+  cur->phase = IDLE;
+  cur->status = ST_DRDY | ST_DSC | (cur->check ? ST_ERR : 0);
+  cur->error = cur->check ? cur->key << 4 : 0;
+  cur->seccnt = 0x03;  // CoD and IO: status phase
+  raise_intrq();
+}
+
+// Present the next DRQ block of 'data', at most byte_limit bytes
+static void start_block() {
+  size_t left = cur->data.size() - cur->data_pos;
+  size_t len = left < cur->byte_limit ? left : cur->byte_limit;
+  cur->block_end = cur->data_pos + len;
+  cur->cyl_l = len & 0xFF;
+  cur->cyl_h = len >> 8;
+  cur->seccnt = 0x02;  // IO: data to the host
+  cur->phase = DATA_IN;
+  cur->status = ST_DRDY | ST_DRQ;
+  raise_intrq();
+}
+
+// Advance through BUSY periods that have run out
+static void tick() {
+  if (cur->phase != BUSY || sim_us < cur->busy_until) {
+    return;
+  }
+  switch (cur->next) {
+    case N_PACKET:
+      cur->phase = PACKET;
+      cur->pac_len = 0;
+      cur->seccnt = 0x01;  // CoD: packet wanted
+      cur->status = ST_DRDY | ST_DRQ;
+      break;
+    case N_BLOCK:
+      start_block();
+      break;
+    case N_DONE:
+      complete();
+      break;
+    case N_RESET:
+      cur->phase = IDLE;
+      cur->status = 0;
+      cur->error = 0x01;
+      set_signature();
+      break;
+  }
+}
+
+// Packet commands
+// ###############
+
+// Append a big endian value to the result
+static void put(int bytes, unsigned long v) {
+  while (bytes--) {
+    cur->data.push_back((v >> (8 * bytes)) & 0xFF);
+  }
+}
+
+static void put_msf(long lba) {
+  uint8_t msf[3];
+  lba_to_msf(lba, msf);
+  put(1, 0);
+  put(1, msf[0]);
+  put(1, msf[1]);
+  put(1, msf[2]);
+}
+
+static void truncate(unsigned long alloc) {
+  if (cur->data.size() > alloc) {
+    cur->data.resize(alloc);
+  }
+}
+
+static bool medium_present() {
+  if (!cur->disc || cur->tray_open) {
+    fail(0x02, 0x3A);  // NOT READY, medium not present
+    return false;
+  }
+  return true;
+}
+
+// Medium present and not in the middle of spinning up
+static bool medium_ready() {
+  if (!medium_present()) {
+    return false;
+  }
+  if (cur->spinning && sim_us < cur->ready_at) {
+    fail(0x02, 0x04);  // NOT READY, becoming ready
+    return false;
+  }
+  return true;
+}
+
+static void spin_up() {
+  if (!cur->spinning) {
+    cur->spinning = true;
+    cur->ready_at = sim_us + T_SPINUP;
+  }
+}
+
+// Commands that need the disc turning spin it up on their own, returns the wait
+static uint64_t spin_wait() {
+  spin_up();
+  return sim_us < cur->ready_at ? cur->ready_at - sim_us : 0;
+}
+
+// Decode the packet, fill 'data' or the sense fields. Returns the busy time.
+static uint64_t execute() {
+  const uint8_t *p = cur->pac;
+  uint64_t busy = T_CMD;
+  cur->check = false;
+  cur->data.clear();
+  cur->data_pos = 0;
+  cur->cmds[p[0]]++;
+
+  if (cur->ua_asc && p[0] != 0x03) {  // Unit attention, reported once
+    fail(0x06, cur->ua_asc);
+    cur->ua_asc = 0;
+    return busy;
+  }
+
+  switch (p[0]) {
+    case 0x00:  // TEST UNIT READY
+      if (medium_ready() && !cur->spinning) {
+        fail(0x02, 0x04);  // Stopped, needs START UNIT
+        cur->ascq = 0x02;
+      }
+      break;
+
+    case 0x03:  // REQUEST SENSE
+      put(1, 0x70);
+      put(1, 0);
+      put(1, cur->key);
+      put(4, 0);
+      put(1, 10);  // Additional length
+      put(4, 0);
+      put(1, cur->asc);
+      put(1, cur->ascq);
+      put(4, 0);
+      truncate(p[4]);
+      cur->key = cur->asc = cur->ascq = 0;
+      break;
+
+    case 0x1B: {  // START STOP UNIT
+      bool loej = p[4] & 0x02;
+      bool start = p[4] & 0x01;
+      set_audio(AS_NONE);
+      if (loej && !start) {  // Eject
+        if (!cur->tray_open) {
+          cur->tray_open = true;
+          cur->spinning = false;
+          busy += T_TRAY;
+        }
+      } else if (loej && start) {  // Load
+        if (cur->tray_open) {
+          cur->tray_open = false;
+          busy += T_TRAY;
+          if (cur->disc) {
+            cur->spinning = true;
+            cur->ready_at = sim_us + busy + T_SPINUP;
+            cur->head_lba = 0;
+          }
+        }
+      } else if (!start) {
+        if (cur->spinning) {
+          cur->spinning = false;
+          busy += T_SPINDOWN;
+        }
+      } else if (medium_present()) {
+        busy += spin_wait();
+      }
+      if (p[1] & 0x01) {  // Immed: status now, the mechanics carry on
+        busy = T_CMD;
+      }
+      break;
+    }
+
+    case 0x2B: {  // SEEK(10)
+      if (!medium_present()) {
+        break;
+      }
+      long lba = ((long)p[2] << 24) | ((long)p[3] << 16) | (p[4] << 8) | p[5];
+      if (lba < 0 || lba >= cur->track_lba[cur->tracks]) {
+        fail(0x05, 0x21);  // ILLEGAL REQUEST, LBA out of range
+        break;
+      }
+      busy += spin_wait() + seek_time(play_pos(), lba);
+      cur->head_lba = lba;
+      cur->seek_done = sim_us + busy;
+      set_audio(AS_NONE);
+      break;
+    }
+
+    case 0x42: {  // READ SUB-CHANNEL, current position only
+      if (!medium_ready()) {
+        break;
+      }
+      long lba = play_pos();
+      int t = track_of(lba);
+      put(1, 0);
+      put(1, cur->audio);
+      put(2, 12);
+      put(1, 0x01);  // Current position
+      put(1, 0x10);  // ADR 1, audio track
+      put(1, t);
+      put(1, 1);     // Index
+      put_msf(lba);
+      put_msf(lba - cur->track_lba[t - 1] - 150);  // Track relative, no 2 s offset
+      if (cur->audio == AS_DONE) {
+        set_audio(AS_NONE);  // Reported once
+      }
+      truncate((p[7] << 8) | p[8]);
+      break;
+    }
+
+    case 0x43: {  // READ TOC, format 0
+      if (!medium_present()) {
+        break;
+      }
+      bool msf = p[1] & 0x02;
+      put(2, 2 + 8 * (cur->tracks + 1));
+      put(1, 1);
+      put(1, cur->tracks);
+      for (int t = 1; t <= cur->tracks + 1; t++) {
+        long lba = cur->track_lba[t - 1];
+        put(1, 0);
+        put(1, 0x10);
+        put(1, t > cur->tracks ? 0xAA : t);
+        put(1, 0);
+        if (msf) {
+          put_msf(lba);
+        } else {
+          put(4, lba);
+        }
+      }
+      busy += spin_wait() + 2000;
+      truncate((p[7] << 8) | p[8]);
+      break;
+    }
+
+    case 0x47: {  // PLAY AUDIO MSF
+      if (!medium_present()) {
+        break;
+      }
+      long from = msf_to_lba(p + 3);
+      long end = msf_to_lba(p + 6);
+      if (from < 0 || end > cur->track_lba[cur->tracks] || from > end) {
+        fail(0x05, 0x21);  // ILLEGAL REQUEST, LBA out of range
+        break;
+      }
+      // ATAPI drives report completion right away and seek on their own, as with
+      // Immed set in the audio control mode page
+      cur->play_from = from;
+      cur->play_end = end;
+      cur->seek_done = sim_us + busy + spin_wait() + seek_time(play_pos(), from);
+      set_audio(AS_PLAY, cur->seek_done);
+      break;
+    }
+
+    case 0x4B:  // PAUSE/RESUME
+      if (p[8] & 0x01) {
+        if (cur->audio != AS_PAUSE) {
+          fail(0x05, 0x2C);  // Command sequence error
+          break;
+        }
+        cur->play_from = cur->pause_lba;  // After the seek of a PLAY paused right away
+        set_audio(AS_PLAY, sim_us + busy > cur->seek_done ? sim_us + busy : cur->seek_done);
+      } else {
+        if (cur->audio != AS_PLAY) {
+          fail(0x05, 0x2C);
+          break;
+        }
+        cur->pause_lba = play_pos();
+        set_audio(AS_PAUSE);
+      }
+      break;
+
+    case 0x4E:  // STOP PLAY/SCAN
+      play_pos();
+      set_audio(AS_NONE);
+      break;
+
+    case 0x5A:  // MODE SENSE(10), header and page 01h
+      put(2, 18);
+      put(1, cur->tray_open ? 0x71 : cur->disc ? 0x02 : 0x70);  // Medium type
+      put(5, 0);
+      put(1, 0x01);
+      put(1, 0x0A);
+      put(10, 0);
+      truncate((p[7] << 8) | p[8]);
+      break;
+
+    case 0xBE: {  // READ CD, CD-DA user data only
+      if (!medium_present()) {
+        break;
+      }
+      long lba = ((long)p[2] << 24) | ((long)p[3] << 16) | (p[4] << 8) | p[5];
+      long n = ((long)p[6] << 16) | (p[7] << 8) | p[8];
+      if (lba < 0 || lba + n > cur->track_lba[cur->tracks]) {
+        fail(0x05, 0x21);
+        break;
+      }
+      busy += spin_wait() + seek_time(play_pos(), lba) + n * 1000000 / (75 * SPEED);
+      set_audio(AS_NONE);
+      cur->head_lba = lba + n;
+      for (long s = 0; s < n; s++) {
+        for (int i = 0; i < CD_RAW; i++) {
+          cur->data.push_back((uint8_t)((lba + s) * 7 + i));
+        }
+      }
+      break;
+    }
+
+    default:
+      fail(0x05, 0x20);  // ILLEGAL REQUEST, invalid command operation code
+  }
+  return busy;
+}
+
+// IDENTIFY PACKET DEVICE data
+static void identify() {
+  uint16_t id[256] = { 0 };
+  id[0] = 0x85C0;  // ATAPI, CD-ROM, removable, accelerated DRQ, 12 byte packets
+  const char *model = cur == drives ? "ATAPIDUINO SIM CD-ROM" : "ATAPIDUINO SIM CD-ROM SLAVE";
+  for (int i = 0; i < 40; i++) {
+    char c = *model ? *model++ : ' ';
+    id[27 + i / 2] |= (uint8_t)c << (i & 1 ? 0 : 8);
+  }
+  id[49] = 0x0A00;  // LBA, IORDY
+  id[53] = 0x0002;
+  id[64] = 0x0003;  // PIO modes 3 and 4
+  cur->data.clear();
+  for (int i = 0; i < 256; i++) {
+    put(1, id[i] & 0xFF);  // Words go out little endian
+    put(1, id[i] >> 8);
+  }
+  cur->data_pos = 0;
+  cur->byte_limit = 512;
+  cur->check = false;
+}
+
+// Register file of one drive
+// ##########################
+
+static void reset() {
+  cur->devctl = 0;
+  cur->head = 0;
+  set_audio(AS_NONE);
+  cur->ua_asc = 0x29;  // Power on, reset
+  cur->key = cur->asc = cur->ascq = 0;
+  if (cur->disc && !cur->tray_open) {
+    cur->spinning = true;
+    cur->ready_at = sim_us + T_SPINUP;
+  }
+  set_busy(T_RESET, N_RESET);
+}
+
+static uint16_t reg_read(int reg) {
+  switch (reg) {
+    case R_DATA: {
+      if (cur->phase != DATA_IN) {
+        return 0xFFFF;
+      }
+      uint16_t w = cur->data[cur->data_pos];
+      if (cur->data_pos + 1 < cur->data.size()) {
+        w |= cur->data[cur->data_pos + 1] << 8;
+      }
+      cur->data_pos += 2;
+      if (cur->data_pos >= cur->block_end) {
+        if (cur->data_pos >= cur->data.size()) {
+          complete();
+        } else {
+          set_busy(T_BLOCK, N_BLOCK);
+        }
+      }
+      return w;
+    }
+    case R_ERROR:
+      return cur->error;
+    case R_SECCNT:
+      return cur->seccnt;
+    case R_SECNUM:
+      return cur->secnum;
+    case R_CYLL:
+      return cur->cyl_l;
+    case R_CYLH:
+      return cur->cyl_h;
+    case R_HEAD:
+      return cur->head;
+    case R_STATUS:
+      cur->intrq = false;  // Reading status acknowledges the interrupt
+      return cur->status;
+    case R_ALTSTAT:
+      return cur->status;
+  }
+  return 0xFFFF;
+}
+
+static void reg_write(int reg, uint16_t val) {
+  uint8_t v = val & 0xFF;
+  switch (reg) {
+    case R_DATA:
+      if (cur->phase == PACKET) {
+        cur->pac[cur->pac_len++] = val & 0xFF;
+        cur->pac[cur->pac_len++] = val >> 8;
+        if (cur->pac_len >= 12) {
+          unsigned int limit = cur->cyl_l | (cur->cyl_h << 8);
+          cur->byte_limit = limit ? limit & ~1u : 0xFFFE;
+          uint64_t busy = execute();
+          set_busy(busy, cur->data.empty() ? N_DONE : N_BLOCK);
+        }
+      }
+      return;
+    case R_ERROR:
+      cur->features = v;
+      return;
+    case R_SECCNT:
+      cur->seccnt = v;
+      return;
+    case R_SECNUM:
+      cur->secnum = v;
+      return;
+    case R_CYLL:
+      cur->cyl_l = v;
+      return;
+    case R_CYLH:
+      cur->cyl_h = v;
+      return;
+    case R_HEAD:
+      cur->head = v;
+      return;
+    case R_ALTSTAT:
+      if ((v & 0x04) && !(cur->devctl & 0x04)) {  // SRST
+        reset();
+      }
+      cur->devctl = v;
+      return;
+    case R_STATUS:
+      break;
+    default:
+      return;
+  }
+
+  // Command register
+  if (cur->phase == BUSY && v != 0x08) {
+    return;  // Ignored while busy, except DEVICE RESET
+  }
+  switch (v) {
+    case 0x08:  // DEVICE RESET
+      set_audio(AS_NONE);
+      set_busy(1000, N_RESET);
+      break;
+    case 0x90:  // EXECUTE DEVICE DIAGNOSTIC
+      cur->error = 0x01;
+      set_signature();
+      set_busy(2000, N_DONE);
+      cur->check = false;
+      break;
+    case 0xA0:  // PACKET
+      set_busy(T_PACKET_DRQ, N_PACKET);
+      break;
+    case 0xA1:  // IDENTIFY PACKET DEVICE
+      identify();
+      set_busy(1000, N_BLOCK);
+      break;
+    default:  // Aborted
+      cur->check = true;
+      cur->key = 0x05;
+      cur->asc = 0x20;
+      complete();
+      cur->error = 0x04;
+  }
+}
+
+// Bus interface
+// #############
+
+// Both drives hold the same Device/Head value, so either tells who is selected
+static AtapiDrive *selected() {
+  return &drives[(drives[0].head & 0x10) ? 1 : 0];
+}
+
+static void tick_all() {
+  for (cur = drives; cur < drives + 2; cur++) {
+    if (cur->present) {
+      tick();
+    }
+  }
+  cur = selected();
+}
+
+void drive_attach(int dev) {
+  drives[dev].present = true;
+}
+
+void drive_hw_reset() {
+  for (cur = drives; cur < drives + 2; cur++) {
+    if (cur->present) {
+      reset();
+    }
+  }
+  cur = selected();
+}
+
+// Without a slave the master answers for it (ATA): status 00h, the other
+// registers as the master holds them, its signature included. Data is not
+// driven. Without a master the bus floats.
+uint16_t drive_read(int reg) {
+  tick_all();
+  if (cur->present) {
+    return reg_read(reg);
+  }
+  if (cur == &drives[1] && drives[0].present && reg != R_DATA) {
+    if (reg == R_STATUS || reg == R_ALTSTAT) {
+      return 0x00;
+    }
+    cur = &drives[0];
+    uint16_t v = reg_read(reg);
+    cur = selected();
+    return v;
+  }
+  return 0xFFFF;
+}
+
+// Data and commands go to the selected drive only, except EXECUTE DEVICE DIAGNOSTIC
+void drive_write(int reg, uint16_t val) {
+  tick_all();
+  AtapiDrive *sel = cur;
+  bool both = reg != R_DATA && (reg != R_STATUS || (val & 0xFF) == 0x90);
+  for (cur = drives; cur < drives + 2; cur++) {
+    if (cur->present && (cur == sel || both)) {
+      reg_write(reg, val);
+    }
+  }
+  cur = selected();
+}
+
+void drive_tray_button(int dev) {
+  cur = &drives[dev];
+  cur->tray_open = !cur->tray_open;
+  set_audio(AS_NONE);
+  cur->spinning = !cur->tray_open && cur->disc;
+  if (cur->spinning) {
+    cur->ready_at = sim_us + T_TRAY + T_SPINUP;
+    cur->ua_asc = 0x28;  // Medium may have changed
+  }
+  cur = selected();
+}
+
+// Put a disc with 'tracks' tracks of 3 to 6 minutes into the tray.
+// 0 takes the disc out.
+void drive_insert(int tracks, int dev) {
+  cur = &drives[dev];
+  cur->disc = tracks > 0;
+  cur->tracks = tracks > 99 ? 99 : tracks;
+  long lba = 0;
+  for (int t = 0; t < cur->tracks; t++) {
+    cur->track_lba[t] = lba;
+    lba += (180 + (t * 37) % 180) * 75L;
+  }
+  cur->track_lba[cur->tracks] = lba;
+  if (!cur->tray_open) {
+    cur->spinning = cur->disc;
+    cur->ready_at = sim_us + T_SPINUP;
+    cur->ua_asc = 0x28;
+  }
+  cur = selected();
+}
+
+bool drive_intrq() {
+  tick_all();
+  return cur->present && cur->intrq;
+}
+
+uint64_t drive_audio_after(uint64_t us) {
+  uint64_t first = 0;
+  for (int i = 0; i < 2; i++) {
+    for (size_t n = 0; n < drives[i].audio_starts.size(); n++) {
+      uint64_t t = drives[i].audio_starts[n];
+      if (t >= us && (!first || t < first)) {
+        first = t;
+      }
+    }
+  }
+  return first;
+}
+
+void drive_report() {
+  for (int i = 0; i < 2; i++) {
+    if (!drives[i].present) {
+      continue;
+    }
+    printf(drives[1].present ? "drive %d: packet commands" : "drive: packet commands", i);
+    for (int op = 0; op < 256; op++) {
+      if (drives[i].cmds[op]) {
+        printf(" %02Xh:%lu", op, drives[i].cmds[op]);
+      }
+    }
+    printf("\n");
+  }
+}
@@ -0,0 +1,72 @@
+// I2C bus accounting and the IDE bus lines between the transport and the drive.
+
+#include "sim.h"
+
+long sim_i2c_clock = 400000;
+unsigned long sim_i2c_trans;
+unsigned long sim_i2c_bytes;
+bool sim_i2c_clock_fixed;
+
+static uint8_t ctrl_lines = 0xFF;      // Pull-ups keep released lines HIGH
+static uint16_t host_out = 0xFFFF;     // Word the host drives on DD0-15
+static uint16_t drive_out = 0xFFFF;    // Word the drive drives on DD0-15 while nDIOR is LOW
+
+void sim_i2c_transaction(int bytes) {
+  sim_i2c_trans++;
+  sim_i2c_bytes += bytes;
+  long bits = I2C_BITS_FIXED + I2C_BITS_PER_BYTE * bytes;
+  sim_advance(bits * 1000000LL / sim_i2c_clock + I2C_OVERHEAD_US);
+}
+
+void sim_i2c_begin(long clock) {
+  if (!sim_i2c_clock_fixed) {
+    sim_i2c_clock = clock;
+  }
+}
+
+double sim_i2c_seconds(long clock) {
+  double bits = (double)I2C_BITS_FIXED * sim_i2c_trans + (double)I2C_BITS_PER_BYTE * sim_i2c_bytes;
+  return bits / clock + sim_i2c_trans * I2C_OVERHEAD_US / 1e6;
+}
+
+int ide_reg_decode(uint8_t ctrl) {
+  bool cs0 = !(ctrl & 0x08);
+  bool cs1 = !(ctrl & 0x10);
+  if (cs0 == cs1) {
+    return -1;  // Neither or both blocks selected
+  }
+  return (cs1 ? 8 : 0) + (ctrl & 0x07);
+}
+
+// Strobe edges are what the drive reacts to.
+void ide_ctrl(uint8_t now) {
+  uint8_t old = ctrl_lines;
+  ctrl_lines = now;
+  if (!(now & 0x20)) {
+    if (old & 0x20) {
+      drive_hw_reset();
+    }
+    return;
+  }
+  int reg = ide_reg_decode(now);
+  if ((old & 0x80) && !(now & 0x80) && reg >= 0) {  // nDIOR falling edge
+    drive_out = drive_read(reg);
+  }
+  if (!(old & 0x80) && (now & 0x80)) {  // nDIOR released, drive lets go of the bus
+    drive_out = 0xFFFF;
+  }
+  if (!(old & 0x40) && (now & 0x40)) {  // nDIOW rising edge latches the data
+    int wreg = ide_reg_decode(old);
+    if (wreg >= 0) {
+      drive_write(wreg, host_out);
+    }
+  }
+}
+
+void ide_host_data(uint16_t w) {
+  host_out = w;
+}
+
+uint16_t ide_data() {
+  return host_out & drive_out;
+}
@@ -0,0 +1,46 @@
+// Port registers for -D BUS_GPIO, wired straight to the IDE bus. Implements the
+// port part of hal.h. I2C is not used by this transport.
+
+#ifdef BUS_GPIO
+
+#include "sim.h"
+#include "hal.h"
+
+const uint64_t PORT_US = 1;  // Call and port access on a 16 MHz AVR, rounded up
+
+static uint8_t ddr[3];
+static uint8_t out[3];
+
+static void update(byte port) {
+  if (port == HAL_PORT_CTRL) {
+    ide_ctrl(out[2] | ~ddr[2]);  // Inputs float HIGH
+    return;
+  }
+  uint16_t dir = ddr[0] | (ddr[1] << 8);
+  uint16_t lat = out[0] | (out[1] << 8);
+  ide_host_data((lat & dir) | ~dir);
+}
+
+void hal_begin(long clock) {
+  (void)clock;
+}
+
+void hal_port_dir(byte port, byte o) {
+  sim_advance(PORT_US);
+  ddr[port] = o;
+  update(port);
+}
+
+void hal_port_write(byte port, byte val) {
+  sim_advance(PORT_US);
+  out[port] = val;
+  update(port);
+}
+
+byte hal_port_read(byte port) {
+  sim_advance(PORT_US);
+  uint8_t ext = port == HAL_PORT_DATAH ? ide_data() >> 8 : ide_data() & 0xFF;
+  return (out[port] & ddr[port]) | (ext & ~ddr[port]);
+}
+
+#endif
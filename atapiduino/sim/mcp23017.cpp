@@ -0,0 +1,141 @@
+// Two virtual MCP23017s for -D BUS_MCP23017, wired as listed at the top of
+// src/bus_mcp23017.cpp. Models IOCON.BANK and IOCON.SEQOP, as the transport
+// relies on both. Implements the I2C part of hal.h.
+
+#ifdef BUS_MCP23017
+
+#include "sim.h"
+#include "hal.h"
+
+const int MCP_DATA = 0x20;  // GPA = DD0-DD7, GPB = DD8-DD15
+const int MCP_CTRL = 0x21;  // GPA = nDIOR nDIOW nRST nCS1 nCS0 DA2 DA1 DA0
+
+// Register functions, the address depends on IOCON.BANK
+enum { IODIR, IPOL, GPINTEN, DEFVAL, INTCON, IOCON, GPPU, INTF, INTCAP, GPIO, OLAT, NREGS };
+const uint8_t IOCON_BANK = 0x80;
+const uint8_t IOCON_SEQOP = 0x20;
+
+struct Mcp {
+  uint8_t reg[NREGS][2];  // [function][port]
+  uint8_t ptr;            // Register pointer
+};
+
+static Mcp mcp[2];
+
+// Register address to function and port, false if unimplemented
+static bool decode(const Mcp &m, uint8_t addr, int *fn, int *port) {
+  if (m.reg[IOCON][0] & IOCON_BANK) {
+    *fn = addr & 0x0F;
+    *port = addr >> 4;
+  } else {
+    *fn = addr >> 1;
+    *port = addr & 1;
+  }
+  return *fn < NREGS && *port < 2;
+}
+
+static void advance(Mcp &m) {
+  uint8_t iocon = m.reg[IOCON][0];
+  if (!(iocon & IOCON_SEQOP)) {
+    m.ptr = (m.ptr + 1) % ((iocon & IOCON_BANK) ? 0x1B : 0x16);
+  } else if (!(iocon & IOCON_BANK)) {
+    m.ptr ^= 1;  // Byte mode with BANK = 0 toggles between the A/B pair
+  }
+}
+
+// Level of a port: outputs drive OLAT, inputs follow the bus
+static uint8_t pins(int chip, int port) {
+  const Mcp &m = mcp[chip];
+  uint8_t out = ~m.reg[IODIR][port];
+  uint8_t ext = 0xFF;
+  if (chip == 0) {
+    ext = port ? ide_data() >> 8 : ide_data() & 0xFF;
+  }
+  return (m.reg[OLAT][port] & out) | (ext & ~out);
+}
+
+// Push the output levels to the IDE lines after a register write
+static void update(int chip) {
+  if (chip == 1) {
+    ide_ctrl(pins(1, 0));
+    return;
+  }
+  const Mcp &m = mcp[0];
+  uint16_t out = ~(m.reg[IODIR][0] | (m.reg[IODIR][1] << 8));
+  uint16_t lat = m.reg[OLAT][0] | (m.reg[OLAT][1] << 8);
+  ide_host_data((lat & out) | ~out);
+}
+
+static void mcp_reset(Mcp &m) {
+  for (int fn = 0; fn < NREGS; fn++) {
+    m.reg[fn][0] = m.reg[fn][1] = fn == IODIR ? 0xFF : 0x00;
+  }
+}
+
+void hal_begin(long clock) {
+  sim_i2c_begin(clock);
+  static bool powered;
+  if (!powered) {
+    mcp_reset(mcp[0]);
+    mcp_reset(mcp[1]);
+    powered = true;
+  }
+}
+
+void hal_i2c_write_buf(int addr, const byte *buf, byte len) {
+  sim_i2c_transaction(len);
+  if (addr != MCP_DATA && addr != MCP_CTRL) {
+    return;
+  }
+  int chip = addr - MCP_DATA;
+  Mcp &m = mcp[chip];
+  m.ptr = buf[0];
+  for (byte i = 1; i < len; i++) {
+    int fn, port;
+    if (decode(m, m.ptr, &fn, &port)) {
+      if (fn == IOCON) {
+        m.reg[IOCON][0] = m.reg[IOCON][1] = buf[i];  // Shared by both ports
+      } else if (fn == GPIO || fn == OLAT) {
+        m.reg[OLAT][port] = buf[i];
+      } else if (fn != INTF && fn != INTCAP) {
+        m.reg[fn][port] = buf[i];
+      }
+      update(chip);
+    }
+    advance(m);
+  }
+}
+
+byte hal_i2c_read(int addr) {
+  byte b = 0xFF;
+  hal_i2c_read_buf(addr, &b, 1);
+  return b;
+}
+
+void hal_i2c_read_reg(int addr, byte reg, byte *buf, byte len) {
+  sim_i2c_transaction(2);  // Register pointer, the read follows after a repeated START
+  if (addr == MCP_DATA || addr == MCP_CTRL) {
+    mcp[addr - MCP_DATA].ptr = reg;
+  }
+  hal_i2c_read_buf(addr, buf, len);
+}
+
+// Sequential read from the register pointer on
+void hal_i2c_read_buf(int addr, byte *buf, byte len) {
+  sim_i2c_transaction(len);
+  if (addr != MCP_DATA && addr != MCP_CTRL) {
+    return;
+  }
+  int chip = addr - MCP_DATA;
+  Mcp &m = mcp[chip];
+  for (byte i = 0; i < len; i++) {
+    int fn, port;
+    buf[i] = 0;
+    if (decode(m, m.ptr, &fn, &port)) {
+      buf[i] = fn == GPIO ? pins(chip, port) : m.reg[fn][port];
+    }
+    advance(m);
+  }
+}
+
+#endif
@@ -0,0 +1,64 @@
+// Three virtual PCF8574s wired to the IDE bus like on the board, see the pin
+// table at the top of src/main.cpp. Implements the I2C part of hal.h for the
+// default transport.
+
+#if !defined(BUS_MCP23017) && !defined(BUS_GPIO)
+
+#include "sim.h"
+#include "hal.h"
+
+const int PCF_DATAL = 0x20;  // IDE DD0-DD7
+const int PCF_DATAH = 0x21;  // IDE DD8-DD15
+const int PCF_REGSEL = 0x22; // nDIOR nDIOW nRST nCS1 nCS0 DA2 DA1 DA0
+
+static uint8_t latch[3] = { 0xFF, 0xFF, 0xFF };  // Output latch, power-on value
+
+void hal_begin(long clock) {
+  sim_i2c_begin(clock);
+}
+
+// The outputs take each byte of a write in turn
+void hal_i2c_write_buf(int addr, const byte *buf, byte len) {
+  sim_i2c_transaction(len);
+  if (addr < PCF_DATAL || addr > PCF_REGSEL) {
+    return;  // Nobody acknowledges
+  }
+  for (byte i = 0; i < len; i++) {
+    latch[addr - PCF_DATAL] = buf[i];
+    if (addr == PCF_REGSEL) {
+      ide_ctrl(buf[i]);
+    } else {
+      ide_host_data(latch[0] | (latch[1] << 8));  // Latched HIGH is a weak pull-up
+    }
+  }
+}
+
+// A pin reads LOW if either the latch or the drive pulls it low
+byte hal_i2c_read(int addr) {
+  sim_i2c_transaction(1);
+  switch (addr) {
+    case PCF_DATAL:
+      return ide_data() & 0xFF;
+    case PCF_DATAH:
+      return ide_data() >> 8;
+    case PCF_REGSEL:
+      return latch[2];
+  }
+  return 0xFF;
+}
+
+// The PCF8574 has no registers, it answers every byte with its pins
+void hal_i2c_read_buf(int addr, byte *buf, byte len) {
+  sim_i2c_transaction(len);
+  for (byte i = 0; i < len; i++) {
+    buf[i] = addr == PCF_DATAH ? ide_data() >> 8 : ide_data() & 0xFF;
+  }
+}
+
+void hal_i2c_read_reg(int addr, byte reg, byte *buf, byte len) {
+  byte b = reg;
+  hal_i2c_write_buf(addr, &b, 1);  // Without the STOP in between on the real bus
+  hal_i2c_read_buf(addr, buf, len);
+}
+
+#endif
@@ -0,0 +1,56 @@
+// Host-native simulator for atapiduino: simulated time, three virtual PCF8574s
+// on the I2C bus and an ATAPI CD-ROM drive model on the other side of them.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+// Simulated time
+// ##############
+
+extern uint64_t sim_us;       // Microseconds since power on
+void sim_advance(uint64_t us);
+
+// I2C bus accounting
+// ##################
+
+// Bus time of one transaction: START, address + ACK, 9 bits per data byte, STOP,
+// plus the CPU time the Wire library spends around it.
+const int I2C_BITS_FIXED = 11;
+const int I2C_BITS_PER_BYTE = 9;
+const int I2C_OVERHEAD_US = 10;
+
+extern long sim_i2c_clock;           // Clock the simulation runs at, Hz
+extern bool sim_i2c_clock_fixed;     // Set with --clock, hal_begin() leaves it alone
+void sim_i2c_begin(long clock);      // Clock requested by the firmware
+extern unsigned long sim_i2c_trans;  // Transactions so far
+extern unsigned long sim_i2c_bytes;  // Data bytes so far
+void sim_i2c_transaction(int bytes);
+double sim_i2c_seconds(long clock);  // Bus time of all transactions at 'clock'
+
+// IDE bus lines (bus.cpp), driven by the model of the transport the firmware
+// is built for: pcf8574.cpp, mcp23017.cpp or gpio.cpp
+// ##########################################################################
+
+// Register numbers as seen by the drive: 0-7 command block (nCS0 low),
+// 8 + DA for the control block (nCS1 low), -1 when no register is selected.
+int ide_reg_decode(uint8_t ctrl);
+void ide_ctrl(uint8_t ctrl);        // New level of nDIOR nDIOW nRST nCS1 nCS0 DA2 DA1 DA0
+void ide_host_data(uint16_t w);     // Level the host puts on DD0-15, 0xFFFF when released
+uint16_t ide_data();                // Level of DD0-15 with host and drive pulling low
+
+// Drive model (atapi_drive.cpp)
+// #############################
+
+void drive_attach(int dev);               // Connect the master (0) or the slave (1)
+void drive_hw_reset();                    // nRST asserted
+uint16_t drive_read(int reg);             // nDIOR falling edge
+void drive_write(int reg, uint16_t val);  // nDIOW rising edge
+void drive_tray_button(int dev);          // Eject button on the drive front
+void drive_insert(int tracks, int dev);   // Disc put into the open tray
+bool drive_intrq();                       // Level of the INTRQ line
+uint64_t drive_audio_after(uint64_t us);  // First audio output at or after 'us', 0 if none
+void drive_report();
+
+#endif
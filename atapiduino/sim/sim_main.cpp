@@ -0,0 +1,412 @@
+// Runs the firmware against the simulated expanders and drive. Implements the
+// Arduino time and Serial functions and the pin part of hal.h, and replays a
+// script of button presses, serial input and tray events.
+//
+// usage: atapiduino_sim [--clock HZ] [--quiet] [script]
+//
+// Script lines are "<ms> <event> [arg]", '#' starts a comment:
+//   press NEXT|PREV|PLAY|STOP|EJCT|DSEL  hold a button down for 150 ms
+//   serial C                         host sends character C
+//   cmd C [N]                        host sends a host link command frame (-D HOST_LINK)
+//   tray [D]                         eject button on the front of drive D (0 master, 1 slave)
+//   disc N [D]                       disc with N tracks, 0 takes it out
+//   slave                            a slave drive is on the cable, at 0 ms only
+//   end                              stop the simulation
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "hal.h"
+
+void setup();
+void loop();
+
+const uint64_t LOOP_US = 20;      // CPU time of one pass through loop() without bus access
+const uint64_t CLOCK_US = 4;      // Reading the clock on the AVR, keeps wait loops moving
+const unsigned long PRESS_MS = 150;
+
+uint64_t sim_us;
+SimSerial Serial;
+
+static bool quiet;
+static bool line_start = true;
+static unsigned long press_until[20];  // millis() a pin is held LOW until
+static uint64_t press_us[64];           // NEXT, PREV, PLAY and host commands, for audio_report()
+static const char *press_name[64];
+static int n_presses;
+static char serial_in[64];
+static int serial_head, serial_tail;
+
+// setup() takes about 12 s, most of it fixed delays for slow drives
+#ifdef BENCH
+static const char default_script[] =
+  "# Operation benchmark against the simulated drive\n"
+  "0 disc 12\n"
+  "13000 serial X\n"
+  "14000 end\n";
+#else
+static const char default_script[] =
+  "# Power on with a 12 track disc, play, skip, pause, eject and reload\n"
+  "0 disc 12\n"
+  "13000 press PLAY\n"
+  "17000 press NEXT\n"
+  "20000 press PREV\n"
+  "23000 press PLAY\n"
+  "25000 press PLAY\n"
+  "28000 press STOP\n"
+  "31000 press EJCT\n"
+  "34000 press EJCT\n"
+  "42000 press PLAY\n"
+  "46000 serial H\n"
+  "47000 end\n";
+#endif
+
+static void (*intrq_isr)();  // Attached to the INTRQ pin with hal_pin_irq()
+static bool intrq_level;
+
+// Time passes, and a rising INTRQ interrupts the firmware at that point
+void sim_advance(uint64_t us) {
+  sim_us += us;
+  if (intrq_isr) {
+    bool level = drive_intrq();
+    if (level && !intrq_level) {
+      intrq_isr();
+    }
+    intrq_level = level;
+  }
+}
+
+unsigned long millis() {
+  sim_advance(CLOCK_US);
+  return sim_us / 1000;
+}
+
+unsigned long micros() {
+  sim_advance(CLOCK_US);
+  return sim_us;
+}
+
+void delay(unsigned long ms) {
+  sim_advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim_advance(us);
+}
+
+void noInterrupts() {}
+void interrupts() {}
+
+// Serial
+// ######
+
+void SimSerial::begin(long b) {
+  baud = b;
+}
+
+int SimSerial::available() {
+  return serial_head != serial_tail;
+}
+
+int SimSerial::read() {
+  if (serial_head == serial_tail) {
+    return -1;
+  }
+  int c = (uint8_t)serial_in[serial_tail];
+  serial_tail = (serial_tail + 1) % sizeof(serial_in);
+  return c;
+}
+
+static uint16_t crc16(uint16_t crc, uint8_t b) {
+  crc ^= b << 8;
+  for (int i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Frames (A5 5A type lenL lenH payload crcL crcH) are decoded and printed as one
+// line, except the audio sectors of a rip. Returns false for bytes outside frames.
+static bool frame_byte(uint8_t b) {
+  static uint8_t hdr[5];
+  static uint8_t payload[32];
+  static unsigned int pos, len;
+  static uint16_t crc;
+  if (pos == 0 && b != 0xA5) {
+    return false;
+  }
+  if (pos < 5) {
+    hdr[pos++] = b;
+    if (pos == 2 && b != 0x5A) {
+      pos = 0;
+    }
+    if (pos >= 3) {
+      crc = crc16(pos == 3 ? 0xFFFF : crc, b);
+    }
+    len = hdr[3] | (hdr[4] << 8);
+    return true;
+  }
+  unsigned int i = pos++ - 5;
+  if (i < len) {
+    crc = crc16(crc, b);
+    if (i < sizeof(payload)) {
+      payload[i] = b;
+    }
+    return true;
+  }
+  if (i == len) {
+    crc ^= b;
+    return true;
+  }
+  bool ok = (crc ^ (b << 8)) == 0;
+  pos = 0;
+  if (!quiet && (hdr[2] != 'S' || !ok)) {
+    printf("%s%9.3f  [%c", line_start ? "" : "\n", sim_us / 1e6, hdr[2]);
+    for (unsigned int j = 0; j < len && j < sizeof(payload); j++) {
+      printf(" %02X", payload[j]);
+    }
+    printf("]%s\n", ok ? "" : " CRC error");
+    line_start = true;
+  }
+  return true;
+}
+
+// Text goes to stdout with a timestamp per line.
+size_t SimSerial::write(uint8_t b) {
+  sent++;
+  if (frame_byte(b) || quiet) {
+    return 1;
+  }
+  if (line_start) {
+    printf("%9.3f  ", sim_us / 1e6);
+    line_start = false;
+  }
+  if (b == '\r') {
+    return 1;
+  }
+  putchar(b);
+  if (b == '\n') {
+    line_start = true;
+  }
+  return 1;
+}
+
+size_t SimSerial::write(const uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    write(buf[i]);
+  }
+  return len;
+}
+
+void SimSerial::print(const char *s) {
+  write((const uint8_t *)s, strlen(s));
+}
+
+void SimSerial::print(char c) {
+  write((uint8_t)c);
+}
+
+void SimSerial::print(long n, int base) {
+  if (n < 0) {
+    write('-');
+    n = -n;
+  }
+  print((unsigned long)n, base);
+}
+
+void SimSerial::print(unsigned long n, int base) {
+  char buf[34];
+  int i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    int d = n % base;
+    buf[--i] = d < 10 ? '0' + d : 'A' + d - 10;
+    n /= base;
+  } while (n);
+  print(buf + i);
+}
+
+void SimSerial::print(double d, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, d);
+  print(buf);
+}
+
+void SimSerial::println() {
+  print("\r\n");
+}
+
+// Pins
+// ####
+
+void hal_pin_input(byte pin) {
+  (void)pin;
+}
+
+void hal_pin_output(byte pin, byte level) {
+  (void)pin;
+  (void)level;
+}
+
+byte hal_pin_read(byte pin) {
+  return pin < 20 && sim_us / 1000 < press_until[pin] ? LOW : HIGH;
+}
+
+// The only interrupt wired up is INTRQ of the drive
+void hal_pin_irq(byte pin, void (*isr)()) {
+  (void)pin;
+  intrq_isr = isr;
+}
+
+// Script
+// ######
+
+struct Event {
+  unsigned long ms;
+  char what[8];
+  char arg[8];
+  char arg2[8];
+};
+
+static Event events[256];
+static int n_events;
+
+static void parse_script(const char *text) {
+  while (*text && n_events < 256) {
+    const char *eol = strchr(text, '\n');
+    size_t len = eol ? (size_t)(eol - text) : strlen(text);
+    char line[80];
+    snprintf(line, sizeof(line), "%.*s", (int)len, text);
+    text += len + (eol ? 1 : 0);
+    Event &e = events[n_events];
+    e.arg[0] = e.arg2[0] = 0;
+    if (line[0] == '#' || sscanf(line, "%lu %7s %7s %7s", &e.ms, e.what, e.arg, e.arg2) < 2) {
+      continue;
+    }
+    n_events++;
+  }
+}
+
+static int button_pin(const char *name) {
+  static const char *names[] = { "PREV", "PLAY", "STOP", "EJCT", "NEXT" };
+  for (int i = 0; i < 5; i++) {
+    if (!strcmp(name, names[i])) {
+      return 8 + i;  // Pin numbers as in src/main.cpp
+    }
+  }
+  return strcmp(name, "DSEL") ? -1 : 14;
+}
+
+// Apply the event, returns false for "end"
+static bool run_event(const Event &e) {
+  if (!strcmp(e.what, "press")) {
+    int pin = button_pin(e.arg);
+    if (pin < 0) {
+      fprintf(stderr, "sim: unknown button %s\n", e.arg);
+    } else {
+      press_until[pin] = sim_us / 1000 + PRESS_MS;
+      if ((pin == 8 || pin == 9 || pin == 12) && n_presses < 64) {
+        press_us[n_presses] = sim_us;
+        press_name[n_presses++] = pin == 8 ? "PREV" : pin == 9 ? "PLAY" : "NEXT";
+      }
+    }
+  } else if (!strcmp(e.what, "serial")) {
+    serial_in[serial_head] = e.arg[0];
+    serial_head = (serial_head + 1) % sizeof(serial_in);
+  } else if (!strcmp(e.what, "cmd")) {
+    uint8_t f[9] = { 0xA5, 0x5A, 'C', 2, 0, (uint8_t)e.arg[0], (uint8_t)atoi(e.arg2) };
+    uint16_t crc = 0xFFFF;
+    for (int i = 2; i < 7; i++) {
+      crc = crc16(crc, f[i]);
+    }
+    f[7] = crc & 0xFF;
+    f[8] = crc >> 8;
+    for (int i = 0; i < 9; i++) {
+      serial_in[serial_head] = f[i];
+      serial_head = (serial_head + 1) % sizeof(serial_in);
+    }
+    if (n_presses < 64) {
+      press_us[n_presses] = sim_us;
+      press_name[n_presses++] = e.arg[0] == 'N' ? "cmd N" : e.arg[0] == 'P' ? "cmd P" : "cmd";
+    }
+  } else if (!strcmp(e.what, "tray")) {
+    drive_tray_button(atoi(e.arg) & 1);
+  } else if (!strcmp(e.what, "disc")) {
+    drive_insert(atoi(e.arg), atoi(e.arg2) & 1);
+  } else if (!strcmp(e.what, "slave")) {
+    drive_attach(1);
+  } else if (!strcmp(e.what, "end")) {
+    return false;
+  } else {
+    fprintf(stderr, "sim: unknown event %s\n", e.what);
+  }
+  return true;
+}
+
+// Time from each press of NEXT, PREV or PLAY, or host command, to the audio it
+// started. Audio that starts only after the next of them is not counted for this one.
+static void audio_report() {
+  for (int i = 0; i < n_presses; i++) {
+    uint64_t t = drive_audio_after(press_us[i]);
+    if (t && (i + 1 == n_presses || t < press_us[i + 1])) {
+      printf("time to audio: %s at %.3f s, %.1f ms\n", press_name[i], press_us[i] / 1e6,
+             (t - press_us[i]) / 1e3);
+    }
+  }
+}
+
+static char *read_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *text = (char *)malloc(len + 1);
+  text[fread(text, 1, len, f)] = 0;
+  fclose(f);
+  return text;
+}
+
+int main(int argc, char **argv) {
+  const char *script = default_script;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--clock") && i + 1 < argc) {
+      sim_i2c_clock = atol(argv[++i]);
+      sim_i2c_clock_fixed = true;
+    } else if (!strcmp(argv[i], "--quiet")) {
+      quiet = true;
+    } else {
+      script = read_file(argv[i]);
+    }
+  }
+  parse_script(script);
+  drive_attach(0);
+
+  int next = 0;
+  while (next < n_events && events[next].ms == 0) {  // Disc in the drive at power on
+    run_event(events[next++]);
+  }
+  drive_hw_reset();
+  setup();
+  bool running = true;
+  while (running && next < n_events) {
+    while (next < n_events && events[next].ms <= sim_us / 1000) {
+      running = run_event(events[next++]) && running;
+    }
+    loop();
+    sim_advance(LOOP_US);
+  }
+
+  printf("\nsim: %.3f s simulated, I2C at %ld Hz\n", sim_us / 1e6, sim_i2c_clock);
+  printf("I2C: %lu transactions, %lu data bytes\n", sim_i2c_trans, sim_i2c_bytes);
+  printf("bus time: %.3f s at 100 kHz, %.3f s at 400 kHz, %.3f s at 1 MHz\n",
+         sim_i2c_seconds(100000), sim_i2c_seconds(400000), sim_i2c_seconds(1000000));
+  printf("serial: %lu bytes written\n", Serial.sent);
+  drive_report();
+  audio_report();
+  return 0;
+}
@@ -0,0 +1,26 @@
+// IDE bus transport under readIDE()/writeIDE(). One backend is compiled in:
+//
+//   default          three PCF8574s, bus_pcf8574.cpp
+//   -D BUS_MCP23017  two MCP23017s, bus_mcp23017.cpp
+//   -D BUS_GPIO      port registers of an Arduino Mega, bus_gpio.cpp
+//
+// Control bytes use the layout of PCF8574#3: nDIOR nDIOW nRST nCS1 nCS0 DA2 DA1 DA0.
+
+#ifndef BUS_H
+#define BUS_H
+
+#include <Arduino.h>
+
+extern const char bus_name[];    // Backend name for the 'B' report
+extern unsigned long bus_trans;  // I2C transactions issued, stays 0 for BUS_GPIO
+extern unsigned long bus_bytes;  // I2C data bytes moved, register pointers included
+
+void bus_begin();                              // Start the transport, all lines released
+void bus_ctrl(byte ctrl);                      // Drive the control lines
+unsigned int bus_read(byte regval);            // One read cycle, returns DD15-DD0
+void bus_write(byte regval, unsigned int w);   // One write cycle
+// Read cycle for runs of reads from one register. nDIOR may stay asserted until
+// the next bus access, so its release can share a transaction with the next read.
+unsigned int bus_read_next(byte regval);
+
+#endif
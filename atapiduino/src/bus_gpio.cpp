@@ -0,0 +1,61 @@
+// IDE bus on the port registers of an Arduino Mega (-D BUS_GPIO), no expanders.
+// Ports and pins are in hal_arduino.cpp.
+
+#ifdef BUS_GPIO
+
+#include "bus.h"
+#include "hal.h"
+
+const char bus_name[] = "GPIO";
+unsigned long bus_trans;  // No I2C traffic
+unsigned long bus_bytes;
+
+static boolean data_in;   // Data ports are inputs
+
+static void data_dir(boolean in) {
+  if (data_in != in) {
+    hal_port_dir(HAL_PORT_DATAL, in ? 0x00 : 0xFF);
+    hal_port_dir(HAL_PORT_DATAH, in ? 0x00 : 0xFF);
+    if (in) {
+      hal_port_write(HAL_PORT_DATAL, 0xFF);  // Pullups
+      hal_port_write(HAL_PORT_DATAH, 0xFF);
+    }
+    data_in = in;
+  }
+}
+
+void bus_begin() {
+  hal_port_write(HAL_PORT_CTRL, 0xFF);
+  hal_port_dir(HAL_PORT_CTRL, 0xFF);
+  data_in = false;
+  data_dir(true);
+}
+
+void bus_ctrl(byte ctrl) {
+  hal_port_write(HAL_PORT_CTRL, ctrl);
+}
+
+// The port accesses take longer than the 165 ns of PIO mode 0 on their own.
+unsigned int bus_read(byte regval) {
+  data_dir(true);
+  hal_port_write(HAL_PORT_CTRL, regval & B01111111);
+  byte l = hal_port_read(HAL_PORT_DATAL);
+  byte h = hal_port_read(HAL_PORT_DATAH);
+  hal_port_write(HAL_PORT_CTRL, regval | B10000000);
+  return (unsigned int)h << 8 | l;
+}
+
+unsigned int bus_read_next(byte regval) {
+  return bus_read(regval);
+}
+
+void bus_write(byte regval, unsigned int w) {
+  hal_port_write(HAL_PORT_CTRL, regval | B01000000);
+  hal_port_write(HAL_PORT_DATAL, lowByte(w));
+  hal_port_write(HAL_PORT_DATAH, highByte(w));
+  data_dir(false);
+  hal_port_write(HAL_PORT_CTRL, regval & B10111111);
+  hal_port_write(HAL_PORT_CTRL, regval | B01000000);
+}
+
+#endif
@@ -0,0 +1,153 @@
+// IDE bus over two MCP23017s (-D BUS_MCP23017).
+//
+//   MCP23017   A2,A1,A0     Addr.
+//       #1     0  0  0     0x20    GPA = IDE DD0-DD7, GPB = IDE DD8-DD15
+//       #2     0  0  1     0x21    GPA = nDIOR nDIOW nRST nCS1 nCS0 DA2 DA1 DA0
+//
+// Both run in byte mode (IOCON.SEQOP = 1). #1 keeps BANK = 0, where the register
+// pointer advances from A to B and back, so a data word moves in one transaction
+// and the pointer is on GPIOA again for the next read. #2 uses BANK = 1, where the
+// pointer stays on OLATA: several bytes in one transaction make a strobe pulse.
+
+#ifdef BUS_MCP23017
+
+#include "bus.h"
+#include "hal.h"
+
+const int MCP_DATA = 0x20;
+const int MCP_CTRL = 0x21;
+
+// The MCP23017 is specified for 1.7 MHz, 1 MHz is the limit of the AVR TWI.
+const long I2C_CLOCK = 1000000;
+
+// Register addresses with IOCON.BANK = 0 (MCP_DATA)
+const byte IODIRA = 0x00;  // IODIRB follows
+const byte IOCON = 0x0A;
+const byte GPIOA = 0x12;   // GPIOB follows
+const byte OLATA = 0x14;   // OLATB follows
+const byte IOCON_BYTE = 0x20;  // SEQOP = 1
+// Register addresses with IOCON.BANK = 1 (MCP_CTRL)
+const byte B1_IODIRA = 0x00;
+const byte B1_IOCON = 0x05;
+const byte B1_OLATA = 0x0A;
+const byte B1_GPINTENB = 0x12;
+const byte IOCON_BANK1_BYTE = 0xA0;  // BANK = 1, SEQOP = 1
+
+const char bus_name[] = "MCP23017";
+unsigned long bus_trans;
+unsigned long bus_bytes;
+
+static byte ctrl_out = 0xFF;         // Last value written to OLATA of MCP_CTRL
+static unsigned int data_out = 0xFFFF;  // Last word written to OLATA/OLATB of MCP_DATA
+static boolean data_in = true;       // Data pins are inputs
+static boolean rd_held;              // nDIOR left asserted by bus_read_next()
+static boolean at_gpio;              // Register pointer of MCP_DATA is on GPIOA
+
+static void mcp_put(int addr, const byte *buf, byte len) {
+  hal_i2c_write_buf(addr, buf, len);
+  bus_trans++;
+  bus_bytes += len;
+  if (addr == MCP_DATA) {
+    at_gpio = false;
+  }
+}
+
+// Drive the control lines with up to three successive values in one transaction
+static void ctrl_put(byte n, byte v0, byte v1 = 0, byte v2 = 0) {
+  byte buf[4] = { B1_OLATA, v0, v1, v2 };
+  mcp_put(MCP_CTRL, buf, n + 1);
+  ctrl_out = buf[n];
+}
+
+static void ctrl_write(byte v) {
+  if (ctrl_out != v) {
+    ctrl_put(1, v);
+  }
+}
+
+static void release() {
+  if (rd_held) {
+    rd_held = false;
+    ctrl_write(ctrl_out | B10000000);
+  }
+}
+
+static void data_dir(boolean in) {
+  if (data_in != in) {
+    byte buf[3] = { IODIRA, (byte)(in ? 0xFF : 0x00), (byte)(in ? 0xFF : 0x00) };
+    mcp_put(MCP_DATA, buf, 3);
+    data_in = in;
+  }
+}
+
+void bus_begin() {
+  hal_begin(I2C_CLOCK);
+  // MCP_CTRL may still be in BANK = 1 after a reset of the Arduino alone. 0x05 is
+  // IOCON with BANK = 1 and GPINTENB with BANK = 0, 0x0B is IOCON with BANK = 0
+  // and unused with BANK = 1, so this sequence reaches BANK = 1 from either.
+  byte b1[2] = { B1_IOCON, IOCON_BANK1_BYTE };
+  mcp_put(MCP_CTRL, b1, 2);
+  byte b0[2] = { 0x0B, IOCON_BANK1_BYTE };
+  mcp_put(MCP_CTRL, b0, 2);
+  byte noint[2] = { B1_GPINTENB, 0x00 };
+  mcp_put(MCP_CTRL, noint, 2);
+  ctrl_put(1, 0xFF);  // All control lines HIGH
+  byte dir[2] = { B1_IODIRA, 0x00 };
+  mcp_put(MCP_CTRL, dir, 2);
+  byte data_mode[2] = { IOCON, IOCON_BYTE };
+  mcp_put(MCP_DATA, data_mode, 2);
+  data_in = false;
+  data_dir(true);
+}
+
+void bus_ctrl(byte ctrl) {
+  release();
+  ctrl_write(ctrl);
+}
+
+// 3 transactions: nDIOR LOW, DD0-15, nDIOR HIGH.
+unsigned int bus_read(byte regval) {
+  unsigned int w = bus_read_next(regval);
+  release();
+  return w;
+}
+
+// A run of reads costs 2 transactions per word: nDIOR HIGH and LOW again, DD0-15.
+unsigned int bus_read_next(byte regval) {
+  data_dir(true);
+  byte low = regval & B01111111;
+  if (rd_held && ctrl_out == low) {
+    ctrl_put(2, regval | B10000000, low);
+  } else {
+    release();
+    ctrl_write(low);
+  }
+  rd_held = true;
+  byte buf[2];
+  if (at_gpio) {
+    hal_i2c_read_buf(MCP_DATA, buf, 2);
+  } else {
+    hal_i2c_read_reg(MCP_DATA, GPIOA, buf, 2);
+    at_gpio = true;
+    bus_trans++;  // The pointer write counts apart from the read after the repeated START
+    bus_bytes++;
+  }
+  bus_trans++;
+  bus_bytes += 2;
+  return (unsigned int)buf[1] << 8 | buf[0];
+}
+
+// Data word and nDIOW pulse are one transaction each.
+void bus_write(byte regval, unsigned int w) {
+  release();
+  ctrl_write(regval | B01000000);
+  if (data_out != w) {
+    byte buf[3] = { OLATA, lowByte(w), highByte(w) };
+    mcp_put(MCP_DATA, buf, 3);
+    data_out = w;
+  }
+  data_dir(false);
+  ctrl_put(2, regval & B10111111, regval | B01000000);
+}
+
+#endif
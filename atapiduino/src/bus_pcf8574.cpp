@@ -0,0 +1,110 @@
+// IDE bus over three PCF8574s, the original wiring. See the pin table at the
+// top of main.cpp.
+
+#if !defined(BUS_MCP23017) && !defined(BUS_GPIO)
+
+#include "bus.h"
+#include "hal.h"
+
+// I/O expander addresses:
+const int DataL = 0x20;   // IDE DD0-DD7
+const int DataH = 0x21;   // IDE DD8-DD15
+const int RegSel = 0x22;  // IDE register
+
+// I2C bus clock. The PCF8574 is specified for 100 kHz, but the parts used so far
+// run reliably at 400 kHz. Lower this value if the bus gets unreliable.
+const long I2C_CLOCK = 400000;
+
+const char bus_name[] = "PCF8574";
+unsigned long bus_trans;
+unsigned long bus_bytes;
+
+// All bus traffic goes through pcf_put()/pcf_write()/pcf_read(). pcf_out[] mirrors the
+// output latch of each PCF8574, so writes that would not change any pin are dropped.
+static byte pcf_out[3] = { 0xFF, 0xFF, 0xFF };  // Last value written to DataL, DataH and RegSel
+static boolean rd_held;                          // nDIOR left asserted by bus_read_next()
+
+// Write bytes to a PCF8475 unconditionally. Its outputs take each byte in turn,
+// so a strobe pulse fits into one transaction.
+static void pcf_put(int addr, const byte *val, byte len) {
+  hal_i2c_write_buf(addr, val, len);
+  pcf_out[addr - DataL] = val[len - 1];
+  bus_trans++;
+  bus_bytes += len;
+}
+
+// Write one byte to a PCF8475 unless its outputs already hold that value.
+static void pcf_write(int addr, byte val) {
+  if (pcf_out[addr - DataL] != val) {
+    pcf_put(addr, &val, 1);
+  }
+}
+
+// Read the pins of a PCF8475. Only pins latched HIGH act as inputs.
+static byte pcf_read(int addr) {
+  bus_trans++;
+  bus_bytes++;
+  return hal_i2c_read(addr);
+}
+
+// Finish a read cycle left open by bus_read_next()
+static void release() {
+  if (rd_held) {
+    rd_held = false;
+    pcf_write(RegSel, pcf_out[RegSel - DataL] | B10000000);
+  }
+}
+
+// Set to high impedance all ports of PCF8475 interfacing to IDE.
+// Always writes, so the pcf_out[] shadow is valid afterwards whatever the power-up state.
+void bus_begin() {
+  byte high = 0xFF;
+  hal_begin(I2C_CLOCK);
+  pcf_put(RegSel, &high, 1);  // IDE Register interface, all pins HIGH
+  pcf_put(DataH, &high, 1);   // IDE DD8-DD15
+  pcf_put(DataL, &high, 1);   // IDE DD0-DD7
+}
+
+void bus_ctrl(byte ctrl) {
+  release();
+  pcf_write(RegSel, ctrl);
+}
+
+// Back-to-back reads cost 4 transactions: nDIOR LOW, DD8-15, DD0-7, nDIOR HIGH.
+unsigned int bus_read(byte regval) {
+  unsigned int w = bus_read_next(regval);
+  release();  // register stays selected
+  return w;
+}
+
+// A run of reads costs 3 transactions per word: nDIOR HIGH and LOW again in one
+// write, DD8-15, DD0-7.
+unsigned int bus_read_next(byte regval) {
+  pcf_write(DataH, 0xFF);  // Data ports must be inputs before the device drives
+  pcf_write(DataL, 0xFF);  // the bus, only written after a bus_write()
+  byte low = regval & B01111111;  // set nDIOR bit LOW preserving register address
+  if (rd_held && pcf_out[RegSel - DataL] == low) {
+    byte pulse[2] = { (byte)(regval | B10000000), low };
+    pcf_put(RegSel, pulse, 2);
+  } else {
+    release();
+    pcf_write(RegSel, low);
+  }
+  rd_held = true;
+  byte h = pcf_read(DataH);
+  byte l = pcf_read(DataL);
+  return (unsigned int)h << 8 | l;
+}
+
+// Address and data bytes equal to what the PCF8574s already hold are not sent again.
+// The nDIOW pulse is one transaction.
+void bus_write(byte regval, unsigned int w) {
+  release();
+  pcf_write(RegSel, regval | B01000000);  // set nDIOW bit HIGH preserving register address
+  pcf_write(DataH, highByte(w));  // send data for IDE D8-D15
+  pcf_write(DataL, lowByte(w));   // send data for IDE D0-D7
+  byte pulse[2] = { (byte)(regval & B10111111), (byte)(regval | B01000000) };
+  pcf_put(RegSel, pulse, 2);  // nDIOW LOW, then released, register stays selected
+}
+
+#endif
@@ -0,0 +1,29 @@
+// Hardware access of the controller: the I2C bus to the PCF8574s and the
+// Arduino pins. hal_arduino.cpp implements it on the board, the native
+// build links the simulated version from sim/ instead.
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <Arduino.h>
+
+void hal_begin(long clock);              // Start the I2C interface as master
+byte hal_i2c_read(int addr);             // One byte read transaction
+void hal_i2c_read_buf(int addr, byte *buf, byte len);         // One read transaction
+void hal_i2c_write_buf(int addr, const byte *buf, byte len);  // One write transaction
+// Write the register pointer 'reg', then read 'len' bytes after a repeated START
+void hal_i2c_read_reg(int addr, byte reg, byte *buf, byte len);
+void hal_pin_input(byte pin);            // Input with pullup
+void hal_pin_output(byte pin, byte level);
+byte hal_pin_read(byte pin);
+void hal_pin_irq(byte pin, void (*isr)());  // Call isr() on each rising edge of 'pin'
+
+// Whole 8 bit ports for the GPIO bus backend (-D BUS_GPIO)
+const byte HAL_PORT_DATAL = 0;  // IDE DD0-DD7
+const byte HAL_PORT_DATAH = 1;  // IDE DD8-DD15
+const byte HAL_PORT_CTRL = 2;   // nDIOR nDIOW nRST nCS1 nCS0 DA2 DA1 DA0
+void hal_port_dir(byte port, byte out);  // Bits set are outputs
+void hal_port_write(byte port, byte val);
+byte hal_port_read(byte port);
+
+#endif
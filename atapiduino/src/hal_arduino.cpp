@@ -0,0 +1,86 @@
+// Hardware access on the Arduino board, see hal.h
+
+#ifdef ARDUINO
+
+#include <Wire.h>  // I2C bus library
+#include "hal.h"
+
+void hal_begin(long clock) {
+  Wire.begin();
+  Wire.setClock(clock);
+}
+
+byte hal_i2c_read(int addr) {
+  Wire.requestFrom(addr, 1);
+  return Wire.read();
+}
+
+void hal_i2c_read_buf(int addr, byte *buf, byte len) {
+  Wire.requestFrom(addr, (int)len);
+  for (byte i = 0; i < len; i++) {
+    buf[i] = Wire.read();
+  }
+}
+
+void hal_i2c_write_buf(int addr, const byte *buf, byte len) {
+  Wire.beginTransmission(addr);
+  Wire.write(buf, len);
+  Wire.endTransmission();
+}
+
+void hal_i2c_read_reg(int addr, byte reg, byte *buf, byte len) {
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  Wire.endTransmission(false);  // No STOP, the read follows with a repeated START
+  Wire.requestFrom(addr, (int)len);
+  for (byte i = 0; i < len; i++) {
+    buf[i] = Wire.read();
+  }
+}
+
+void hal_pin_input(byte pin) {
+  pinMode(pin, INPUT);
+  digitalWrite(pin, HIGH);  // pullup
+}
+
+void hal_pin_output(byte pin, byte level) {
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, level);
+}
+
+byte hal_pin_read(byte pin) {
+  return digitalRead(pin);
+}
+
+// Only pins with an external interrupt work here, D2 and D3 on an ATmega328.
+// No pullup: INTRQ floats while nIEN is set and needs a pulldown.
+void hal_pin_irq(byte pin, void (*isr)()) {
+  pinMode(pin, INPUT);
+  attachInterrupt(digitalPinToInterrupt(pin), isr, RISING);
+}
+
+#ifdef BUS_GPIO
+#ifndef PORTL
+#error "BUS_GPIO needs the ports of an ATmega1280/2560 (Arduino Mega)"
+#endif
+
+// DD0-DD7 on PORTA (D22-D29), DD8-DD15 on PORTC (D37-D30),
+// control lines on PORTL (D49-D42), indexed by HAL_PORT_*
+static volatile uint8_t *const port_ddr[] = { &DDRA, &DDRC, &DDRL };
+static volatile uint8_t *const port_out[] = { &PORTA, &PORTC, &PORTL };
+static volatile uint8_t *const port_in[] = { &PINA, &PINC, &PINL };
+
+void hal_port_dir(byte port, byte out) {
+  *port_ddr[port] = out;
+}
+
+void hal_port_write(byte port, byte val) {
+  *port_out[port] = val;
+}
+
+byte hal_port_read(byte port) {
+  return *port_in[port];
+}
+#endif
+
+#endif
@@ -34,16 +34,80 @@
  ##########################################################################################
 */
 
-#include <Wire.h>  // I2C bus library
+#include "hal.h"   // I2C bus and pin access
+#include "bus.h"   // IDE bus transport
+#include "packets.h"
 #include "main.h"
 
 // Start of Definitions
 // ####################
 
-// I/O expander addresses:
-const int DataL = 0x20;   // IDE DD0-DD7
-const int DataH = 0x21;   // IDE DD8-DD15
-const int RegSel = 0x22;  // IDE register
+// Digital audio extraction (DAE)
+const long LCD_BAUD = 9600;      // Serial speed for the display
+const long DAE_BAUD = 500000;    // Serial speed while streaming audio sectors
+const unsigned int CD_RAW = 2352;  // Bytes per CD-DA sector
+const byte DAE_BURST = 8;          // Sectors requested per READ CD command
+const byte DAE_CHUNK = 64;         // Bytes moved from the bus per step, half the ring
+const byte DAE_SYNC1 = 0xA5;       // Frame start: DAE_SYNC1 DAE_SYNC2 type lenL lenH
+const byte DAE_SYNC2 = 0x5A;       // payload crcL crcH, CRC-16/CCITT over type..payload
+const byte DAE_HEADER = 5;         // Frame bytes before the payload
+const byte DAE_TRAILER = 2;        // and after it
+
+// Host link (build with -D HOST_LINK): status and commands as frames like the DAE ones
+#ifdef HOST_LINK
+const long SERIAL_BAUD = 115200;   // Serial speed outside of a rip
+#else
+const long SERIAL_BAUD = LCD_BAUD;
+#endif
+const byte LINK_MAX = 4;           // Longest command payload accepted
+const byte LINK_STATUS = 11;       // Bytes in a 'T' status frame
+
+// Operation benchmark (build with -D BENCH), started with 'X' on the serial line
+const byte BENCH_RUNS = 16;        // Times each operation is run
+
+// Pause between the periodic sub-channel reads of a drive, by state, see subch_ivl()
+const unsigned int POLL_FAST = 100;       // ms, within POLL_NEAR of the next track, or after a command
+const byte POLL_NEAR = 3;                 // s before the next track starts while playing
+const byte POLL_LATE = 20;                // ms after the second shown has changed while playing
+const unsigned int POLL_IDLE = 2000;      // ms while paused or stopped
+const unsigned int POLL_EMPTY = 500;      // ms without a disc, doubles each read up to POLL_EMPTY_MAX
+const unsigned int POLL_EMPTY_MAX = 8000;
+
+// Seek-ahead while paused (build with -D SEEK_AHEAD)
+const unsigned int SEEK_IDLE = 2000;  // ms paused before the pickup is parked on the next track
+
+// Devices on the IDE cable, build with -D IDE_DEVICES=2 for a master and a slave
+#ifndef IDE_DEVICES
+#define IDE_DEVICES 1
+#endif
+
+// ATAPI command engine
+const byte CMD_QUEUE = 4;                // Commands that can wait for each device
+const byte CMD_IDLE = 0;                 // Phases of the command at the queue head
+const byte CMD_ISSUE = 1;                // waiting for BSY=0, DRQ=0 to write PACKET
+const byte CMD_PACKET = 2;               // waiting for DRQ to send the packet bytes
+const byte CMD_EXEC = 3;                 // waiting for data or completion
+const byte CMD_DATA = 4;                 // data phase, on_data() is called each poll
+const unsigned int T_ISSUE = 5000;       // ms timeout for the device to become idle
+const unsigned int T_PACKET = 1000;      // ms timeout for DRQ after the PACKET opcode
+const byte ST_TIMEOUT = 0xFF;            // Status passed to on_done() after a timeout
+const unsigned int T_WAIT = 5000;        // ms timeout of the blocking wait helpers
+const unsigned int T_IDENTIFY = 500;     // ms for a slave to answer IDENTIFY PACKET DEVICE
+const byte POLL_MAX_MS = 16;             // Longest pause between polls in the wait helpers
+#ifdef IDE_INTRQ
+const byte DEV_CTRL = B00001000;         // Device Control: nIEN clear, the device drives INTRQ
+const unsigned int INTRQ_BACKSTOP = 1000;  // ms between status polls while INTRQ is awaited
+#else
+const byte DEV_CTRL = B00001010;         // Device Control: nIEN set, INTRQ is ignored
+#endif
+const byte BTN_DEBOUNCE = 30;            // ms a button edge must be stable
+const byte MAX_TRACKS = 99;              // Audio CDs have at most 99 tracks
+const byte DRQ_SLOW = 0;                 // Microprocessor DRQ: packet wanted within 3 ms
+const byte DRQ_INTR = 1;                 // Interrupt DRQ: within 10 ms, with INTRQ
+const byte DRQ_FAST = 2;                 // Accelerated DRQ: within 50 us
+const byte DRQ_FIRST_POLL[] = { 1, 3, 0 };  // ms from PACKET to the first DRQ poll, by DRQ type
+const unsigned int BLOCK_MAX = 0xFFFE;   // Largest byte count limit, in whole words
+const unsigned int BLOCK_OLD = 0x0200;   // Byte count limit for drives below PIO mode 3
 
 // IDE Register addresses
 const byte DataReg = 0xF0;  // Addr. Data register of IDE device.
@@ -60,49 +124,156 @@ const byte AStCReg = 0xEE;  // Addr. Alternate Status/Device Control (rd/wr) reg
 byte dataLval;     // dataLval and dataHval hold data from/to
 byte dataHval;     // D0-D15 of IDE
 byte regval;       // regval holds addr. of reg. to be addressed on IDE
-byte reg;          // Holds the addr. of the IDE register with adapted
-                   // nDIOR/nDIOW/nRST values to suit purpose.
-byte cnt;          // packet byte counter
-byte idx;          // index used as pointer within packet array
-byte paclen = 12;  // Default packet length
-byte s_trck;       // Holds start track
-byte e_trck;       // Holds end track
-byte c_trck;       // Follows current track while reading TOC
-byte c_trck_m;     // MSF values for current track
-byte c_trck_s;
-byte c_trck_f;
-byte a_trck = 1;  // Holds actual track from reading subchannel data
-byte MFS_M;       // Holds actual M value from reading subchannel data
-byte MFS_S;       // Holds actual S value from reading subchannel data
-byte d_trck;      // Destination track
-byte d_trck_m;    // MSF values for destination track
-byte d_trck_s;
-byte d_trck_f;
-byte aud_stat = 0xFF;  // subchannel data: 0x11=play, 0x12=pause, 0x15=stop
-byte asc;
-unsigned long prev_millis = 0;
-unsigned long interval = 100;
-boolean toc;
-
-// Array containing sets of 16 byte packets corresponding to part of the CD-ROM
-// ATAPI function set. If the IDE device only supports packets with 12 byte length
-// the last 4 bytes are not sent. The great majority of tested devices use 12 byte.
-
-byte fnc[] = {
-  0x1B, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=0 Open tray
-  0x1B, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=16 Close tray
-  0x1B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=32 Stop unit
-  0x47, 0x00, 0x00, 0x10, 0x28, 0x05, 0x4C, 0x1A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=48 Start PLAY
-  0x4B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=64 PAUSE play
-  0x4B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=80 RESUME play
-  0x43, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=96 Read TOC
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=112 unit ready
-  0x5A, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=128 mode sense
-  0x42, 0x02, 0x40, 0x01, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=144 rd subch.
-  0x03, 0x00, 0x00, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // idx=160 req. sense
-  0x4E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00   // idx=176 Stop disk
+byte ide_stat;          // Status register value seen last by pio_start()/SendPac()
+boolean pio_stat_ok;    // ide_stat is still current, no need to read it again
+unsigned int pio_left;  // Bytes left in the current DRQ block
+byte dae_ring[2 * DAE_CHUNK];  // DAE output, one half fills from the bus while the other drains
+byte dae_head;                 // Next free byte in dae_ring
+byte dae_tail;                 // Next byte to go to the UART
+byte dae_used;                 // Bytes waiting in dae_ring
+unsigned int dae_crc;          // CRC of the frame being sent
+unsigned int dae_overruns;     // Bytes dropped by dae_put() because dae_ring was full
+
+struct TocEntry {
+  byte ctrl;  // ADR and control nibbles, bit 2 set for data tracks
+  byte m;     // Start address as MSF
+  byte s;
+  byte f;
 };
 
+// How patiently to poll for each packet opcode. While a command executes the
+// first status read comes after 'first' ms, then the pause doubles up to 'max' ms.
+// The table stays in flash, entries are copied with memcpy_P() or read with pgm_read_*().
+struct PollCfg {
+  byte opcode;           // Packet opcode, the last entry catches all others
+  unsigned int timeout;  // ms the device may stay busy executing the command
+  byte first;            // ms before the first status poll
+  byte max;              // ms the pause between polls may grow to
+};
+const PollCfg poll_cfg[] PROGMEM = {
+  { 0x1B, 15000, 20, 250 },  // Start/stop unit: tray and spin-up take seconds
+  { 0x47, 10000, 5, 100 },   // Play audio MSF: seek first
+  { 0x4B, 2000, 1, 20 },     // Pause/resume
+  { 0x4E, 5000, 2, 50 },     // Stop play/scan
+  { 0x2B, 5000, 20, 100 },   // Seek: the pickup moves
+  { 0x43, 5000, 0, 20 },     // Read TOC
+  { 0x42, 2000, 0, 10 },     // Read sub-channel
+  { 0x5A, 2000, 0, 10 },     // Mode sense
+  { 0x03, 2000, 0, 10 },     // Request sense
+  { 0x00, 5000, 1, 50 },     // Test unit ready
+  { 0xBE, 10000, 0, 10 },    // Read CD
+  { 0xFF, 5000, 1, 50 }      // Anything else
+};
+const byte POLL_CFGS = sizeof(poll_cfg) / sizeof(poll_cfg[0]);
+
+// Wait statistics per poll_cfg[] entry, dumped with 'H' on the serial line.
+// hist[] counts commands by duration: <2, <8, <32, <128, <512, <2048, <8192, more ms.
+struct WaitStat {
+  unsigned int cmds;    // Commands completed
+  unsigned long polls;  // Status reads spent waiting for them
+  unsigned int max_ms;  // Longest command
+  byte hist[8];         // Saturates at 255
+};
+WaitStat wait_stat[POLL_CFGS];
+unsigned long wait_polls;  // Status reads done while waiting, all commands
+volatile boolean intrq_seen;  // INTRQ rose since the last status read (-D IDE_INTRQ)
+
+struct AtapiCmd {
+  byte pac[PAC_LEN];           // Packet, copied from flash when queued
+  byte cfg;                    // Index into poll_cfg[]
+  boolean (*on_data)(byte step);  // Reads one piece of the data phase, true when done
+  void (*on_done)(byte stat);  // Called with the final status register value
+  unsigned long trans;         // bus_trans when the command was started
+  boolean btn;                 // First command queued after a button press
+};
+
+// What IDENTIFY PACKET DEVICE tells about a device, see id_parse()
+struct DevCaps {
+  byte paclen;              // Packet length, 12 or 16
+  byte drq;                 // DRQ_SLOW, DRQ_INTR or DRQ_FAST
+  byte pio;                 // Highest PIO mode
+  byte queue;               // Queue depth if command queuing is supported, else 0
+  boolean iordy;            // IORDY flow control
+  boolean overlap;          // Overlapped commands
+  boolean dma;
+  unsigned int sets;        // Word 82, command and feature sets supported
+  unsigned int byte_limit;  // Byte count limit loaded for each command
+};
+
+// Everything known about one device on the cable. drv points at the one being
+// worked on: while cmd_poll() runs a command the device it was queued for,
+// otherwise the one the buttons and the display belong to.
+struct Drive {
+  byte dev;             // HeadReg value selecting it: 0x00 master, 0x10 slave
+  boolean present;      // Signature found by setup()
+  DevCaps cap;          // From IDENTIFY PACKET DEVICE
+  byte s_trck;          // Holds start track
+  byte e_trck;          // Holds end track
+  byte a_trck;          // Holds actual track from reading subchannel data
+  byte MFS_M;           // Holds actual M value from reading subchannel data
+  byte MFS_S;           // Holds actual S value from reading subchannel data
+  byte aud_stat;        // subchannel data: 0x11=play, 0x12=pause, 0x15=stop
+  unsigned long stat_since;  // millis() when aud_stat last changed or play() was called
+  byte abs_msf[3];      // Absolute MSF of the last sub-channel read
+  byte parked;          // Track seek_ahead() moved the pickup to, 0 if none
+  byte asc;             // Additional sense code of the last REQUEST SENSE
+  byte disk_ok;         // Result of chck_disk(): 0x00 audio disc, 0x71 open, 0xFF none
+  boolean toc;          // CD data shown since the disc stopped
+  boolean toc_valid;    // toc_tab[] and toc_lead describe the disc in the drive
+  TocEntry toc_lead;    // Lead-out, the end of the last track
+  byte play_msf[6];     // PLAY AUDIO MSF start and end, set from the TOC
+  unsigned long prev_millis;  // Last periodic sub-channel read
+  unsigned int poll_ivl;      // ms until the next one, from subch_ivl()
+  byte shown_stat;      // aud_stat, a_trck, MFS_M and MFS_S as last shown by subch_done()
+  byte shown_trck;
+  byte shown_m;
+  byte shown_s;
+  AtapiCmd cmd_q[CMD_QUEUE];  // Ring of queued commands, cmd_q[cmd_first] runs next
+  byte cmd_first;
+  byte cmd_count;
+};
+Drive drives[IDE_DEVICES];
+// Track n is toc_tab[n - 1], filled by read_TOC(). One table for all devices, it
+// holds the TOC of the device whose toc_valid is set. The other reads its TOC
+// again when it needs it: 396 bytes less SRAM per device.
+TocEntry toc_tab[MAX_TRACKS];
+Drive *drv = &drives[0];
+byte ui_dev;                   // drives[] index the buttons and the display belong to
+byte cmd_dev;                  // drives[] index of the command cmd_poll() is running
+byte dev_sel = 0xFF;           // HeadReg value written last
+byte cmd_phase = CMD_IDLE;
+byte cmd_step;                 // Counts on_data() calls within the data phase
+unsigned long cmd_since;       // millis() when the current phase began
+unsigned long cmd_start;       // millis() when the running command began
+unsigned long cmd_polls;       // wait_polls when the running command began
+unsigned long cmd_next;        // millis() of the next status poll
+unsigned int cmd_ivl;          // Current pause between status polls, ms
+byte btn_prev = 0xFF;          // Last accepted level of the buttons, bit n = pin PREV + n
+unsigned long btn_millis;      // When the last button edge was accepted
+boolean btn_open;              // No command queued yet for the last press
+unsigned long lat_max;         // Worst button-to-packet latency seen, ms
+
+// Packets of the part of the CD-ROM ATAPI function set used here, built at compile
+// time into flash. If the IDE device wants 16 byte packets, pac_send() adds 4 zeros.
+
+// With two devices START STOP UNIT returns before the tray has moved (Immed), so the
+// other device is not locked out of the bus for seconds, see cmd_poll().
+const boolean SSU_IMMED = IDE_DEVICES > 1;
+const Packet PAC_EJECT PROGMEM = start_stop_unit(true, false, SSU_IMMED);  // Open tray
+const Packet PAC_LOAD PROGMEM = start_stop_unit(true, true, SSU_IMMED);  // Close tray
+const Packet PAC_STOP PROGMEM = start_stop_unit(false, false, SSU_IMMED);  // Stop unit
+const Packet PAC_PLAY PROGMEM = play_audio_msf();                // MSF from play_msf[]
+const Packet PAC_PAUSE PROGMEM = pause_resume(false);
+const Packet PAC_RESUME PROGMEM = pause_resume(true);
+const Packet PAC_TOC PROGMEM = read_toc(0xFFFF);
+const Packet PAC_READY PROGMEM = test_unit_ready();
+const Packet PAC_MEDIUM PROGMEM = mode_sense(0x01, 8);           // Header only, for the medium type
+const Packet PAC_SUBCH PROGMEM = read_subchannel(0x01, 16);      // Current position
+const Packet PAC_SENSE PROGMEM = request_sense(18);
+const Packet PAC_STOP_PLAY PROGMEM = stop_play_scan();
+const Packet PAC_READ_CD PROGMEM = read_cd(1, 0x10);             // CD-DA, user data only
+const Packet PAC_SEEK PROGMEM = seek();                          // LBA filled in by seek_ahead()
+
 // Arduino pin assignments:
 const byte LED = 13;
 const byte NEXT = 12;  // NEXT button
@@ -110,131 +281,235 @@ const byte EJCT = 11;  // EJECT button, open/close CD-ROM tray
 const byte STOP = 10;  // STOP button
 const byte PLAY = 9;   // PLAY button
 const byte PREV = 8;   // PREV button
+const byte DSEL = 14;  // Device select button with -D IDE_DEVICES=2, A0 (D14 on a Mega)
+const byte INTRQ = 2;  // IDE INTRQ with -D IDE_INTRQ, external interrupt INT0
 
 // End of Definitions ########################################################################
 
 void setup() {
 
-  // start I2C interface as Master
-  Wire.begin();
-
   // Start Serial Interface
-  Serial.begin(9600);  // init LCD interface
+  Serial.begin(SERIAL_BAUD);  // init LCD interface or host link
 
-  // Set all pins of all PCF8574 to high impedance inputs.
-  highZ();
+  // Start I2C interface as Master and set all IDE lines to high impedance.
+  bus_begin();
 
   // initialize the push button pins as inputs with pullup:
-  pinMode(NEXT, INPUT);
-  pinMode(PREV, INPUT);
-  pinMode(EJCT, INPUT);
-  pinMode(STOP, INPUT);
-  pinMode(PLAY, INPUT);
-  pinMode(LED, OUTPUT);
-
-  digitalWrite((byte)NEXT, HIGH);
-  digitalWrite((byte)PREV, HIGH);
-  digitalWrite((byte)EJCT, HIGH);
-  digitalWrite((byte)STOP, HIGH);
-  digitalWrite((byte)PLAY, HIGH);
-  digitalWrite((byte)LED, LOW);
+  hal_pin_input(NEXT);
+  hal_pin_input(PREV);
+  hal_pin_input(EJCT);
+  hal_pin_input(STOP);
+  hal_pin_input(PLAY);
+  hal_pin_output(LED, LOW);
+#if IDE_DEVICES > 1
+  hal_pin_input(DSEL);
+#endif
+#ifdef IDE_INTRQ
+  hal_pin_irq(INTRQ, intrq_isr);
+#endif
 
   // IDE Initialisation Part
   // ########################
 
-  Serial.println("Atapiduino");
-  Serial.println("Release 3.1");
+  Serial.println(F("Atapiduino"));
+  Serial.println(F("Release 3.1"));
 
   reset_IDE();       
   delay(5000);       // Increased to 5 seconds for slower drives
-  BSY_clear_wait();  
-  DRY_set_wait();    
-
-  readIDE(CylLReg);  // Check device signature for ATAPI capability
-  if (dataLval == 0x14 || dataLval == 0x69) {  // Added alternative signature
-    readIDE(CylHReg);
-    if (dataLval == 0xEB || dataLval == 0x96) { // Added alternative signature
-      Serial.println("Found ATAPI Dev.");
-    } else {
-      Serial.println("Invalid ATAPI signature high byte");
-      while(1);
-    }
-  } else {
-    Serial.println("Invalid ATAPI signature low byte");
-    while(1);
+  for (byte i = 0; i < IDE_DEVICES; i++) {
+    drv = &drives[i];
+    drv->dev = i << 4;  // DEV bit of the Device/Head register
+    drv->cap.paclen = 12;   // Default packet length
+    drv->cap.byte_limit = BLOCK_OLD;
+    drv->a_trck = 1;
+    drv->aud_stat = 0xFF;
+    drv->shown_stat = 0xFF;
+    dev_detect();
   }
-  writeIDE(HeadReg, 0x00, 0xFF);  // Set Device to Master (Device 0)
-
-  // Initialise task file
-  // ####################
-  init_task_file();
 
   // Run Self Diagnostic
   // ###################
+  drv = &drives[0];
+  dev_select();
   delay(3000);
 
-  Serial.println("Self Diag. ");
+  Serial.println(F("Self Diag. "));
   writeIDE(ComSReg, 0x90, 0xFF);  // Issue Run Self Diagnostic Command
   readIDE(ErrFReg);
   if (dataLval == 0x01) {
-    Serial.println("OK");
+    Serial.println(F("OK"));
   } else {
-    Serial.println("Fail");  // Units failing this may still work fine
+    Serial.println(F("Fail"));  // Units failing this may still work fine
   }
 
   delay(3000);
 
-  Serial.println("ATAPI Device:");
+  for (byte i = 0; i < IDE_DEVICES; i++) {
+    drv = &drives[i];
+    if (drv->present) {
+      dev_setup();
+    }
+  }
+  drv = &drives[ui_dev];
+}
+
+// Take word 'i' of the IDENTIFY PACKET DEVICE block into drv->cap
+void id_parse(unsigned int i, unsigned int w) {
+  static boolean adv_pio;  // Word 64 is valid
+  DevCaps *c = &drv->cap;
+  switch (i) {
+    case 0:
+      c->paclen = (w & 0x03) == 0x01 ? 16 : 12;
+      c->drq = (w >> 5) & 0x03;
+      if (c->drq > DRQ_FAST) {  // Reserved value
+        c->drq = DRQ_SLOW;
+      }
+      break;
+    case 49:  // Capabilities
+      c->dma = w & (1 << 8);
+      c->iordy = w & (1 << 11);
+      c->overlap = w & (1 << 13);
+      c->queue = (w & (1 << 14)) ? 1 : 0;
+      break;
+    case 51:  // PIO mode 0-2
+      c->pio = min(highByte(w), 2);
+      break;
+    case 53:  // Words 64-70 valid
+      adv_pio = w & (1 << 1);
+      break;
+    case 64:  // Advanced PIO modes
+      if (adv_pio && (w & (1 << 1))) {
+        c->pio = 4;
+      } else if (adv_pio && (w & (1 << 0))) {
+        c->pio = 3;
+      }
+      break;
+    case 75:  // Queue depth
+      if (c->queue) {
+        c->queue = (w & 0x1F) + 1;
+      }
+      break;
+    case 82:
+      c->sets = (w == 0xFFFF) ? 0 : w;
+      break;
+    case 255:
+      // Drives that time PIO mode 3 or better, or hold the host off with
+      // IORDY, can fill a DRQ block as large as the byte count allows.
+      c->byte_limit = (c->pio >= 3 || c->iordy) ? BLOCK_MAX : BLOCK_OLD;
+  }
+}
+
+// One line of capabilities below the model name: PIO mode, DRQ type, packet length
+void id_show() {
+  static const char drq_name[][6] = { "3ms", "INTRQ", "50us" };
+  Serial.print(F("PIO"));
+  Serial.print(drv->cap.pio);
+  Serial.print(F(" DRQ "));
+  Serial.print(drq_name[drv->cap.drq]);
+  Serial.print(' ');
+  Serial.println(drv->cap.paclen);
+}
+
+// Check the signature of drv for ATAPI capability. Without a master there is
+// nothing to do, a slave that does not answer is left out. Without a slave the
+// master answers for it, with status 00h and its own signature, so a slave only
+// counts once it has sent IDENTIFY PACKET DEVICE data.
+void dev_detect() {
+  dev_select();
+  if (drv->dev) {
+    readIDE(ComSReg);
+    if (dataLval == 0xFF) {  // Nobody drives the bus
+      return;
+    }
+  }
+  BSY_clear_wait();
+  stat_wait((1 << 7) | (1 << 6), 1 << 6, 500);  // DRDY, packet devices may leave it clear
+
+  readIDE(CylLReg);  // Check device signature for ATAPI capability
+  if (dataLval == 0x14 || dataLval == 0x69) {  // Added alternative signature
+    readIDE(CylHReg);
+    if (dataLval == 0xEB || dataLval == 0x96) { // Added alternative signature
+      if (drv->dev && !dev_identifies()) {
+        Serial.println(F("No slave"));
+        return;
+      }
+      Serial.println(F("Found ATAPI Dev."));
+      drv->present = true;
+    } else if (!drv->dev) {
+      Serial.println(F("Invalid ATAPI signature high byte"));
+      while(1);
+    }
+  } else if (!drv->dev) {
+    Serial.println(F("Invalid ATAPI signature low byte"));
+    while(1);
+  }
+}
+
+// True if drv sends an IDENTIFY PACKET DEVICE block. The data is discarded,
+// dev_setup() asks again once all devices are found.
+boolean dev_identifies() {
+  writeIDE(ComSReg, 0xA1, 0xFF);  // Issue Identify Device Command
+  if (!stat_wait((1 << 7) | (1 << 3), 1 << 3, T_IDENTIFY)) {
+    return false;
+  }
+  for (unsigned int i = 0; i < 256; i++) {
+    bus_read_next(DataReg);
+  }
+  readIDE(AStCReg);
+  DRQ_clear_wait();
+  return true;
+}
+
+// Identify drv and wait until it is ready
+void dev_setup() {
+  dev_select();
+  Serial.println(F("ATAPI Device:"));
 
   // Identify Device
   // ###############
   writeIDE(ComSReg, 0xA1, 0xFF);  // Issue Identify Device Command
-  delay(500);
-  
-  // Add timeout for identify command
-  unsigned long startTime = millis();
-  boolean timeout = false;
-  
-  do {
-    readIDE(DataReg);
-    if (cnt == 0) {
-      if (dataLval & (1 << 0)) {
-        paclen = 16;
+  if (DRQ_set_wait()) {           // One block of 256 words
+    char model[41];
+    for (unsigned int i = 0; i < 256; i++) {
+      unsigned int w = bus_read_next(DataReg);
+      id_parse(i, w);
+      if (i >= 27 && i < 47) {  // Model name, two characters per word, high byte first
+        model[2 * (i - 27)] = highByte(w);
+        model[2 * (i - 27) + 1] = lowByte(w);
       }
     }
-    if (cnt > 26 && cnt < 47) {
-      Serial.print(dataHval);
-      Serial.print(dataLval);
-    }
-    cnt++;
-    readIDE(ComSReg);
-    
-    // Add timeout check
-    if(millis() - startTime > 5000) {
-      timeout = true;
-      break;
+    byte n = 40;
+    while (n > 0 && model[n - 1] == ' ') {
+      n--;
     }
-  } while (dataLval & (1 << 3));
-  
-  if(timeout) {
-    Serial.println("Identify Device Command timeout");
-    // Maybe try to recover here instead of hanging
+    model[n] = 0;
+    Serial.println(model);
+    id_show();
+  } else {
+    Serial.println(F("Identify Device Command timeout"));
   }
   readIDE(AStCReg);
   DRQ_clear_wait();
 
+  // Initialise task file
+  // ####################
+  init_task_file();  // Now that the capabilities are known
+
   // Check if unit ready
   // ###################
   unit_ready();       // Send packet 'test unit ready'
   req_sense();        // Send packet 'Request Sense'
-  if (asc == 0x29) {  // Req. Sense returns 'HW Reset'
+  cmd_wait();
+  if (drv->asc == 0x29) {  // Req. Sense returns 'HW Reset'
     unit_ready();     // (ASC=29h) at first since we had one.
     req_sense();      // New Req. Sense returns if media
-  }                   // is present or not.
+    cmd_wait();       // is present or not.
+  }
   do {
     unit_ready();         // Wait until drive is ready.
     req_sense();          // Some devices take some time
-  } while (asc == 0x04);  // ASC=04h -> LOGICAL DRIVE NOT READY
+    cmd_wait();
+  } while (drv->asc == 0x04);  // ASC=04h -> LOGICAL DRIVE NOT READY
 }
 
 // ############
@@ -244,38 +519,47 @@ void setup() {
 
 // This part reads the push buttons, checks device audio status, interprets operator commands
 // and displays the corresponding data depending on the status and/or the commands resulting
-// from pressing the push buttons.
+// from pressing the push buttons. Commands only get queued here, cmd_poll() moves them
+// through the device one status read at a time, so the buttons are scanned all the time.
 
 void loop() {
-  // Scan push buttons
-  if (digitalRead(EJCT) == LOW) {
-    toc = false;  // Set toc invalid
-    switch (chck_disk()) {
-      case 0x00:  // If disk in tray case
-        Serial.println("OPEN");
-        eject();
-        break;
-      case 0xFF:  // If tray closed but no disk in case
-        eject();
-        Serial.println("OPEN");
-        break;
-      case 0X71:  // If tray open -> close it
-        Serial.println("LOAD");
-        load();
-    }
+  cmd_poll();
+
+  // A host on the serial line may request a rip of the whole disc,
+  // the wait statistics or the speed of the bus transport
+  int c = Serial.available() ? Serial.read() : -1;
+#ifdef HOST_LINK
+  c = link_rx(c);  // Bytes of command frames are taken here
+  link_status();
+  dae_pump();
+#endif
+  switch (c) {
+    case 'R':
+      rip_disc();
+      break;
+    case 'H':
+      wait_dump();
+      break;
+    case 'B':
+      bus_bench();
+#ifdef BENCH
+      break;
+    case 'X':
+      bench_ops();
+#endif
+  }
 
-    a_trck = s_trck;  // Reset to start track
+  // Scan push buttons
+  if (pressed(EJCT)) {
+    tray();
   }
 
-  if (digitalRead(STOP) == LOW) {
-    a_trck = s_trck;  // Reset to start track
-    stop_disk();      // Stop Disk
-    stop();           // Stop unit
-    toc = false;
+  if (pressed(STOP)) {
+    stop_all();
   }
 
-  if (digitalRead(PLAY) == LOW) {  // Play has been pressed
-    switch (aud_stat) {
+  if (pressed(PLAY)) {  // Play has been pressed
+    switch (drv->aud_stat) {
       case 0x15:  // If stopped
         play();   // start play
         break;
@@ -285,56 +569,226 @@ void loop() {
       case 0x11:  // if playing
         pause();  // pause playback
     }
-    toc = false;  // mark TOC unknown in case disk
-                  // is removed using device eject buton
-  }               // while play in progress
-
-  if (digitalRead(NEXT) == LOW) {
-    a_trck = a_trck + 1;                         // a_track becomes next track
-    if (a_trck > e_trck) { (a_trck = s_trck); }  // over last track? -> point to start track
-    get_TOC();                                   // Get MSF for a_trck
-    fnc[51] = d_trck_m;                          // Store new play start position
-    fnc[52] = d_trck_s;                          // in play packet and start play
-    fnc[53] = d_trck_f;
-    play();
-    if (aud_stat == 0x12 || aud_stat == 0x15) {  // If paused or stopped -> pause
-      pause();
-    }
+    drv->toc = false;  // mark TOC unknown in case disk
+                       // is removed using device eject buton
+  }                    // while play in progress
+
+  if (pressed(NEXT)) {
+    drv->a_trck = drv->a_trck + 1;  // a_track becomes next track
+    if (drv->a_trck > drv->e_trck) { (drv->a_trck = drv->s_trck); }  // over last track? -> point to start track
+    play_track();
   }
 
-  if (digitalRead(PREV) == LOW) {  // Basically like the NEXT function above
-    a_trck = a_trck - 1;           // only backwards
-    if (a_trck < s_trck) { (a_trck = e_trck); }
-    get_TOC();
-    fnc[51] = d_trck_m;
-    fnc[52] = d_trck_s;
-    fnc[53] = d_trck_f;
-    play();
-    if (aud_stat == 0x12 || aud_stat == 0x15) {  // If paused or stopped -> pause
-      pause();
-    }
+  if (pressed(PREV)) {  // Basically like the NEXT function above
+    drv->a_trck = drv->a_trck - 1;  // only backwards
+    if (drv->a_trck < drv->s_trck) { (drv->a_trck = drv->e_trck); }
+    play_track();
   }
 
-  if (millis() - prev_millis > interval) {  // This part will periodically check the
-    read_subch_cmd();                       // current audio status and update the display
-    if (aud_stat == 0x11) {                 // accordingly.
-      Serial.println("PLAY");
-      curr_MSF();  // Display pickup position
-    }
-    if (aud_stat == 0x12) {
-      Serial.println("PAUSE");
-      curr_MSF();
-    }
-    if (aud_stat == 0x15 && !toc) {  // If stopped and TOC invalid
-      get_TOC();                     
-      Disp_CD_data();               
-      toc = true;                    
+#if IDE_DEVICES > 1
+  if (pressed(DSEL)) {
+    dev_next();
+  }
+#endif
+
+  for (byte i = 0; i < IDE_DEVICES; i++) {  // This part will periodically check the
+    drv = &drives[i];                        // current audio status of each device,
+    if (drv->present && millis() - drv->prev_millis >= drv->poll_ivl && cmd_idle()) {
+      read_subch_cmd();                      // subch_done() updates the display
+      drv->prev_millis = millis();           // accordingly.
     }
-    if (aud_stat == 0x00) {       // Audio status 0 covers all other posible
-                                  // states not decoded by this sketch and
-      Serial.println("NO DISC");  // handles them as NO DISC.
+  }
+  drv = &drives[ui_dev];
+}
+
+// Report a button press once per HIGH to LOW edge. Level changes closer than
+// BTN_DEBOUNCE ms to the last accepted edge are ignored.
+boolean pressed(byte pin) {
+  byte mask = 1 << (pin - PREV);
+  byte level = hal_pin_read(pin) == LOW ? 0 : mask;
+  if (level == (btn_prev & mask) || millis() - btn_millis < BTN_DEBOUNCE) {
+    return false;
+  }
+  btn_prev = (btn_prev & ~mask) | level;
+  btn_millis = millis();
+  btn_open = !level;
+  if (!level) {
+    drv->poll_ivl = POLL_FAST;  // Show what the press did soon
+  }
+  return !level;
+}
+
+// Actions of the EJCT, STOP and DSEL buttons, also used by the host link
+
+void tray() {
+  drv->toc = false;       // Set toc invalid
+  chck_disk(eject_done);  // Open or close depending on the tray
+}
+
+void stop_all() {
+  drv->a_trck = drv->s_trck;  // Reset to start track
+  stop_disk();      // Stop Disk
+  stop();           // Stop unit
+  drv->toc = false;
+}
+
+// Hand the buttons and the display to the next device found
+void dev_next() {
+  byte i = ui_dev;
+  do {
+    i = (i + 1) % IDE_DEVICES;
+  } while (!drives[i].present);
+  dev_show(i);
+}
+
+void dev_show(byte i) {
+  ui_dev = i;
+  drv = &drives[i];
+  drv->toc = false;  // Show its CD data again once it is stopped
+  drv->shown_stat = 0xFF;  // and its status at the next sub-channel read
+  disp(drv->dev ? F("SLAVE") : F("MASTER"));
+}
+
+// Completion handlers for commands queued from loop()
+
+void eject_done(byte stat) {
+  switch (drv->disk_ok) {
+    case 0x00:  // If disk in tray case
+      disp(F("OPEN"));
+      eject();
+      break;
+    case 0xFF:  // If tray closed but no disk in case
+      eject();
+      disp(F("OPEN"));
+      break;
+    case 0X71:  // If tray open -> close it
+      disp(F("LOAD"));
+      load();
+  }
+  drv->a_trck = drv->s_trck;  // Reset to start track
+}
+
+// Start a_trck from the cached TOC. Only if the cache is gone the TOC is read
+// first, skip_done() then comes back here.
+void play_track() {
+  if (!drv->toc_valid) {
+    get_TOC(skip_done);
+    return;
+  }
+  if (drv->a_trck < drv->s_trck || drv->a_trck > drv->e_trck) {  // Track range of a new disc
+    drv->a_trck = drv->s_trck;
+  }
+  TocEntry *t = &toc_tab[drv->a_trck - 1];
+  drv->play_msf[0] = t->m;  // Store new play start position
+  drv->play_msf[1] = t->s;  // and start play
+  drv->play_msf[2] = t->f;
+  play();
+  if (drv->aud_stat == 0x12 || drv->aud_stat == 0x15) {  // If paused or stopped -> pause
+    pause();
+  }
+}
+
+void skip_done(byte stat) {
+  if (drv->toc_valid) {
+    play_track();
+  }
+}
+
+void subch_done(byte stat) {
+  if (stat & (1 << 0)) {  // Command failed or timed out, no audio status.
+    drv->aud_stat = 0;    // Request Sense tells if the medium has changed
+    req_sense();
+  }
+  drv->poll_ivl = subch_ivl();
+  if (drv->aud_stat != drv->shown_stat || drv->a_trck != drv->shown_trck ||
+      drv->MFS_M != drv->shown_m || drv->MFS_S != drv->shown_s) {
+    subch_show();  // Only changes go to the display
+  }
+  if (drv->aud_stat == 0x15 && !drv->toc) {  // If stopped and CD data not shown
+    if (drv->toc_valid) {
+      Disp_CD_data();
+    } else {
+      get_TOC(toc_done);
     }
-    prev_millis = millis();
+    drv->toc = true;
+  }
+  if (drv->aud_stat == 0x00) {
+    drv->parked = 0;
+  }
+#ifdef SEEK_AHEAD
+  seek_ahead();
+#endif
+}
+
+void subch_show() {
+  drv->shown_stat = drv->aud_stat;
+  drv->shown_trck = drv->a_trck;
+  drv->shown_m = drv->MFS_M;
+  drv->shown_s = drv->MFS_S;
+  if (drv->aud_stat == 0x11) {  // Update the display
+    disp(F("PLAY"));
+    curr_MSF();  // Display pickup position
+  }
+  if (drv->aud_stat == 0x12) {
+    disp(F("PAUSE"));
+    curr_MSF();
+  }
+  if (drv->aud_stat == 0x00) {  // Audio status 0 covers all other posible
+                                // states not decoded by this sketch and
+    disp(F("NO DISC"));            // handles them as NO DISC.
+  }
+}
+
+// ms until the next periodic sub-channel read of drv. While playing the read comes
+// just after the second shown changes, or every POLL_FAST ms when the next track
+// starts within POLL_NEAR s. Without a disc the pause doubles from read to read.
+unsigned int subch_ivl() {
+  switch (drv->aud_stat) {
+    case 0x11:
+      if (drv->toc_valid) {
+        TocEntry *t = drv->a_trck < drv->e_trck ? &toc_tab[drv->a_trck] : &drv->toc_lead;
+        long left = msf_to_lba(t->m, t->s, t->f) - msf_to_lba(drv->abs_msf[0], drv->abs_msf[1], drv->abs_msf[2]);
+        if (left < POLL_NEAR * 75L) {
+          return POLL_FAST;
+        }
+      }
+      return (75 - drv->abs_msf[2]) * 40 / 3 + POLL_LATE;  // 75 frames per second
+    case 0x12:
+    case 0x15:
+      return POLL_IDLE;
+  }
+  if (drv->poll_ivl < POLL_EMPTY) {
+    return POLL_EMPTY;
+  }
+  return drv->poll_ivl < POLL_EMPTY_MAX / 2 ? drv->poll_ivl * 2 : POLL_EMPTY_MAX;
+}
+
+// Park the pickup at the start of the track NEXT goes to once the drive has been
+// paused for SEEK_IDLE ms, so the PLAY AUDIO MSF after the press finds it there.
+// SEEK ends the pause on the drive: read_subch() keeps showing the pause and
+// resume() plays from abs_msf[]. Nothing is done while playing, as SEEK would
+// stop the audio, and near the end of a track the pickup is close anyway.
+void seek_ahead() {
+  if (drv->aud_stat != 0x12 || drv->parked || !drv->toc_valid ||
+      millis() - drv->stat_since < SEEK_IDLE) {
+    return;
+  }
+  byte t = drv->a_trck + 1 > drv->e_trck ? drv->s_trck : drv->a_trck + 1;
+  TocEntry *e = &toc_tab[t - 1];
+  long lba = msf_to_lba(e->m, e->s, e->f);
+  byte *pac = cmd_queue(&PAC_SEEK, NULL, NULL);
+  if (pac) {
+    pac[SEEK_LBA] = (byte)(lba >> 24);  // Starting LBA
+    pac[SEEK_LBA + 1] = (byte)(lba >> 16);
+    pac[SEEK_LBA + 2] = (byte)(lba >> 8);
+    pac[SEEK_LBA + 3] = (byte)lba;
+    drv->parked = t;
+  }
+}
+
+void toc_done(byte stat) {
+  if (drv->toc_valid) {
+    Disp_CD_data();
   }
 }
 
@@ -342,324 +796,1131 @@ void loop() {
 // Auxiliary functions for displaying data
 // #######################################
 
-void Disp_CD_data() {        // Used to display track range and
-                             // Total playing time as recovered
-  Serial.print("Tracks  ");  // from reading the TOC
-  Serial.print(s_trck, DEC);
-  Serial.print("-");
-  Serial.println(e_trck, DEC);
+// With HOST_LINK nothing is shown, the host gets 'T' frames from link_status().
+
+// Only the device the buttons belong to is shown
+boolean on_display() {
+  return drv == &drives[ui_dev];
+}
+
+void disp(const __FlashStringHelper *msg) {  // Show a status word, from flash
+#ifndef HOST_LINK
+  if (on_display()) {
+    Serial.println(msg);
+  }
+#endif
+}
 
-  Serial.print("Time   ");
-  Serial.print(fnc[54], DEC);
-  Serial.print(":");
-  if (fnc[55] < 10) {
-    Serial.print("0");  // Print a leading 0 for seconds when below 10
+void Disp_CD_data() {        // Used to display track range and
+#ifndef HOST_LINK            // Total playing time as recovered
+  if (!on_display()) {       // from reading the TOC
+    return;
+  }
+  Serial.print(F("Tracks  "));
+  Serial.print(drv->s_trck, DEC);
+  Serial.print('-');
+  Serial.println(drv->e_trck, DEC);
+
+  Serial.print(F("Time   "));
+  Serial.print(drv->toc_lead.m, DEC);
+  Serial.print(':');
+  if (drv->toc_lead.s < 10) {
+    Serial.print('0');  // Print a leading 0 for seconds when below 10
   }
-  Serial.println(fnc[55], DEC);
+  Serial.println(drv->toc_lead.s, DEC);
+#endif
 }
 
 void curr_MSF() {  // During PLAY or PAUSE operation show the pickup
-  Serial.println(a_trck, DEC);
-  Serial.println(MFS_M, DEC);
-  Serial.println(":");
-  if (MFS_S < 10) {
-    Serial.println("0");  // Print a leading 0 for seconds when below 10
+#ifndef HOST_LINK
+  if (!on_display()) {
+    return;
+  }
+  Serial.println(drv->a_trck, DEC);
+  Serial.println(drv->MFS_M, DEC);
+  Serial.println(':');
+  if (drv->MFS_S < 10) {
+    Serial.println('0');  // Print a leading 0 for seconds when below 10
   }
-  Serial.println(MFS_S, DEC);
+  Serial.println(drv->MFS_S, DEC);
+#endif
 }
 // ##################################
 // Auxiliary functions User Interface
 // ##################################
 
 void play() {
-  idx = 48;   // pointer to play function and Play
-  SendPac();  // from MSF location stored at idx=(51-56)
-}  // See also doc. sff8020i table 76
+  byte *pac = cmd_queue(&PAC_PLAY, NULL, NULL);  // Play from the MSF locations
+  if (pac) {                                    // in play_msf[], see also doc.
+    memcpy(pac + PLAY_START, drv->play_msf, 6); // sff8020i table 76
+  }
+  drv->parked = 0;
+  drv->stat_since = millis();  // A track picked while paused is not parked away from
+}
 void stop() {
-  idx = 32;  // pointer to stop unit function
-  SendPac();
+  cmd_queue(&PAC_STOP, NULL, NULL);
 }
 void eject() {
-  idx = 0;  // pointer to eject function
-  SendPac();
+  drv->toc_valid = false;
+  drv->parked = 0;
+  cmd_queue(&PAC_EJECT, NULL, NULL);
 }
 void load() {
-  idx = 16;  // pointer to load
-  SendPac();
+  drv->toc_valid = false;
+  drv->parked = 0;
+  cmd_queue(&PAC_LOAD, NULL, NULL);
 }
 void pause() {
-  idx = 64;  // pointer to hold
-  SendPac();
+  cmd_queue(&PAC_PAUSE, NULL, NULL);
 }
 void resume() {
-  idx = 80;  // pointer to resume
-  SendPac();
+  if (drv->parked) {  // The drive left the pause for seek_ahead()
+    byte *pac = cmd_queue(&PAC_PLAY, NULL, NULL);
+    if (pac) {
+      memcpy(pac + PLAY_START, drv->abs_msf, 3);  // Where the pause was
+      memcpy(pac + PLAY_END, drv->play_msf + 3, 3);
+    }
+    drv->parked = 0;
+    return;
+  }
+  cmd_queue(&PAC_RESUME, NULL, NULL);
 }
 void stop_disk() {
-  idx = 176;  // pointer to stop disk function
-  SendPac();
+  cmd_queue(&PAC_STOP_PLAY, NULL, NULL);
+  drv->parked = 0;
 }
 
-// ###########################
-// Auxiliary functions PCF8475
-// ###########################
+// #######################
+// Auxiliary functions bus
+// #######################
+
+// Print the number of I2C transactions a command spent since 'start' (build with -D BUS_STATS).
+void bus_stat(byte opcode, unsigned long start) {
+#ifdef BUS_STATS
+  Serial.print(opcode, HEX);
+  Serial.print(F(" I2C "));
+  Serial.println(bus_trans - start);
+#endif
+}
 
-// Set to high impedance all ports of PCF8475 interfacing to IDE.
-void highZ() {
-  Wire.beginTransmission(RegSel);  // address IDE Register interface
-  Wire.write((byte)255);           // queue FFh into buffer for setting all pins HIGH
-  Wire.endTransmission();          // transmit buffered data to IDE Register interface
-  Wire.beginTransmission(DataH);   // address IDE DD8-DD15
-  Wire.write((byte)255);           // as above
-  Wire.endTransmission();          //
-  Wire.beginTransmission(DataL);   // address IDE DD0-DD7
-  Wire.write((byte)255);           // as above
-  Wire.endTransmission();          //
+// Print the words per second the bus transport moves, for single reads as in
+// status polls and for runs of reads as in data phases. Reads the alternate
+// status register, which has no side effects.
+void bus_bench() {
+  const unsigned int n = 256;
+  unsigned long t = micros();
+  for (unsigned int i = 0; i < n; i++) {
+    bus_read(AStCReg);
+  }
+  unsigned long single = micros() - t;
+  t = micros();
+  for (unsigned int i = 0; i < n; i++) {
+    bus_read_next(AStCReg);
+  }
+  bus_ctrl(AStCReg);  // Release nDIOR
+  unsigned long run = micros() - t;
+  Serial.print(bus_name);
+  Serial.print(F(" words/s "));
+  Serial.print(n * 1000000UL / single);
+  Serial.print(F(" run "));
+  Serial.println(n * 1000000UL / run);
+}
+
+// ##############################
+// Operation benchmark (-D BENCH)
+// ##############################
+
+// Each operation queues its commands on drv. Completion handlers that update
+// the display are left out, so only bus and drive time is measured.
+#ifdef BENCH
+void bench_toc() {
+  get_TOC(NULL);
+}
+void bench_subch() {
+  cmd_queue(&PAC_SUBCH, read_subch, NULL);
+}
+void bench_medium() {
+  chck_disk(NULL);
+}
+
+struct BenchOp {
+  const char *name;
+  void (*run)();
+};
+const BenchOp bench_op[] = {
+  { "PLAY", play },
+  { "TOC", bench_toc },
+  { "SUBCH", bench_subch },
+  { "MEDIUM", bench_medium },
+  { "SENSE", req_sense },
+  { "READY", unit_ready }
+};
+
+// Run every operation BENCH_RUNS times to completion. One line each: name,
+// min/avg/max us, and I2C transactions and data bytes per run.
+void bench_ops() {
+  cmd_wait();
+  Serial.print(bus_name);
+  Serial.println(F(" OP MIN AVG MAX us TRANS BYTES"));
+  for (byte i = 0; i < sizeof(bench_op) / sizeof(bench_op[0]); i++) {
+    unsigned long lo = 0xFFFFFFFF, hi = 0, sum = 0;
+    unsigned long trans = bus_trans, bytes = bus_bytes;
+    for (byte n = 0; n < BENCH_RUNS; n++) {
+      unsigned long t = micros();
+      bench_op[i].run();
+      cmd_wait();
+      t = micros() - t;
+      lo = min(lo, t);
+      hi = max(hi, t);
+      sum += t;
+    }
+    Serial.print(bench_op[i].name);
+    Serial.print(' ');
+    Serial.print(lo);
+    Serial.print(' ');
+    Serial.print(sum / BENCH_RUNS);
+    Serial.print(' ');
+    Serial.print(hi);
+    Serial.print(' ');
+    Serial.print((bus_trans - trans) / BENCH_RUNS);
+    Serial.print(' ');
+    Serial.println((bus_bytes - bytes) / BENCH_RUNS);
+  }
 }
+#endif
 
 // Reset Device
 void reset_IDE() {
-  Wire.beginTransmission(RegSel);
-  Wire.write((byte)B11011111);  // Bit 5 LOW to reset IDE via nRESET
-  Wire.endTransmission();
+  bus_ctrl(B11011111);  // Bit 5 LOW to reset IDE via nRESET
   delay(40);
-  Wire.beginTransmission(RegSel);
-  Wire.write((byte)B11111111);  // Release reset
-  Wire.endTransmission();
+  bus_ctrl(B11111111);  // Release reset
   delay(20);
   
   // Add status check after reset
   readIDE(AStCReg);
   if(dataLval == 0xFF) {  // If all bits are 1, device might not be present
-    Serial.println("Device not responding after reset");
+    Serial.println(F("Device not responding after reset"));
     return;
   }
 }
 
 // Read one word from IDE register
 void readIDE(byte regval) {
-  reg = regval & B01111111;  // set nDIOR bit LOW preserving register address
-  Wire.beginTransmission(RegSel);
-  Wire.write((byte)reg);
-  Wire.endTransmission();
-  Wire.requestFrom(DataH, 1);
-  dataHval = Wire.read();
-  Wire.requestFrom(DataL, 1);
-  dataLval = Wire.read();
-  highZ();  // set all I/O pins to HIGH -> impl. nDIOR release
+  unsigned int w = bus_read(regval);
+  dataLval = lowByte(w);
+  dataHval = highByte(w);
 }
 
 // Write one word to IDE register
 void writeIDE(byte regval, byte dataLval, byte dataHval) {
-  reg = regval | B01000000;  // set nDIOW bit HIGH preserving register address
-  Wire.beginTransmission(RegSel);
-  Wire.write((byte)reg);
-  Wire.endTransmission();
-  Wire.beginTransmission(DataH);  // send data for IDE D8-D15
-  Wire.write((byte)dataHval);
-  Wire.endTransmission();
-  Wire.beginTransmission(DataL);  // send data for IDE D0-D7
-  Wire.write((byte)dataLval);
-  Wire.endTransmission();
-  reg = regval & B10111111;  // set nDIOW LOW preserving register address
-  Wire.beginTransmission(RegSel);
-  Wire.write((byte)reg);
-  Wire.endTransmission();
-  highZ();  // All I/O pins to high impedance -> impl. nDIOW release
+  bus_write(regval, (unsigned int)dataHval << 8 | dataLval);
+}
+
+// Make drv the device the task file talks to. Only written when it changes.
+void dev_select() {
+  if (dev_sel != drv->dev) {
+    writeIDE(HeadReg, drv->dev, 0xFF);
+    dev_sel = drv->dev;
+    readIDE(AStCReg);  // Status is valid 400 ns after the switch
+  }
 }
 
 // #################################################
 // Auxiliary functions ATAPI Status Register related
 // #################################################
 
-// Wait for BSY clear
-void BSY_clear_wait() {
-  do {
+// Poll the status register until (status & mask) == want. The pause between polls
+// doubles from 1 ms up to POLL_MAX_MS. Returns false if 'timeout' ms pass first.
+// dataLval holds the last status read.
+boolean stat_wait(byte mask, byte want, unsigned int timeout) {
+  unsigned long start = millis();
+  byte pause = 0;
+  for (;;) {
+    intrq_seen = false;
     readIDE(ComSReg);
-  } while (dataLval & (1 << 7));
+    wait_polls++;
+    if ((dataLval & mask) == want) {
+      return true;
+    }
+    if (millis() - start > timeout) {
+      return false;
+    }
+    intrq_sleep(pause);
+    pause = pause ? min(pause * 2, POLL_MAX_MS) : 1;
+  }
+}
+
+// Pause for 'ms' unless INTRQ rises first. Without -D IDE_INTRQ just a delay().
+void intrq_sleep(byte ms) {
+#ifdef IDE_INTRQ
+  unsigned long start = millis();
+  while (!intrq_seen && millis() - start < ms) {
+  }
+#else
+  delay(ms);
+#endif
+}
+
+// The device raises INTRQ when it finishes a command or has a DRQ block ready.
+// Only flags it: the status read that clears INTRQ needs the bus, which the
+// interrupted code may be using.
+void intrq_isr() {
+  intrq_seen = true;
+}
+
+// Wait for BSY clear
+boolean BSY_clear_wait() {
+  return stat_wait(1 << 7, 0, T_WAIT);
 }
 
 // Wait for DRQ clear
-void DRQ_clear_wait() {
-  do {
-    readIDE(ComSReg);
-  } while (dataLval & (1 << 3));
+boolean DRQ_clear_wait() {
+  return stat_wait(1 << 3, 0, T_WAIT);
 }
 
 // Wait for DRQ set
-void DRQ_set_wait() {
-  do {
-    readIDE(ComSReg);
-  } while ((dataLval & ~(1 << 3)) == true);
+boolean DRQ_set_wait() {
+  return stat_wait((1 << 7) | (1 << 3), 1 << 3, T_WAIT);
 }
 
 // Wait for DRY set
-void DRY_set_wait() {
-  do {
-    readIDE(ComSReg);
-  } while ((dataLval & ~(1 << 6)) == true);
+boolean DRY_set_wait() {
+  return stat_wait((1 << 7) | (1 << 6), 1 << 6, T_WAIT);
 }
 
 // ##################################
 // Auxiliary functions Packet related
 // ##################################
 
-// Send a packet starting at fnc array position idx
-void SendPac() {
-  writeIDE(AStCReg, B00001010, 0xFF);  // Set nIEN before you send the PACKET command!
+// Write the PACKET command. The device answers with DRQ once it wants the packet.
+// The byte count limit is part of the command: the device leaves the size of the
+// last DRQ block in CylL/CylH, and with two drives the task file is shared.
+void pac_issue(unsigned int limit) {
+  set_byte_count(limit);
+  writeIDE(AStCReg, DEV_CTRL, 0xFF);  // nIEN as built, before you send the PACKET command!
   writeIDE(ComSReg, 0xA0, 0xFF);       // Write Packet Command Opcode
-  delay(400);
-  for (cnt = 0; cnt < paclen; cnt = cnt + 2) {  // Send packet with length of 'paclen'
-    dataLval = fnc[(idx + cnt)];                // to IDE Data Registeraccording to idx value
-    dataHval = fnc[(idx + cnt + 1)];
-    writeIDE(DataReg, dataLval, dataHval);
-    readIDE(AStCReg);  // Read alternate stat reg.
-    readIDE(AStCReg);  // Read alternate stat reg.
+}
+
+// Send the PAC_LEN packet bytes to the IDE Data Register, padded with zeros up
+// to 'paclen' for devices that want 16 byte packets
+void pac_send(const byte *pac) {
+  for (byte i = 0; i < drv->cap.paclen; i += 2) {
+    if (i < PAC_LEN) {
+      writeIDE(DataReg, pac[i], pac[i + 1]);
+    } else {
+      writeIDE(DataReg, 0x00, 0x00);
+    }
+    if (drv->cap.drq != DRQ_FAST) {  // Give slow drives time to take the word
+      readIDE(AStCReg);  // Read alternate stat reg.
+      readIDE(AStCReg);  // Read alternate stat reg.
+    }
   }
-  BSY_clear_wait();
 }
 
-void get_TOC() {
-  idx = 96;   // Pointer to Read TOC Packet
-  SendPac();  // Send read TOC command packet
-  delay(10);
-  DRQ_set_wait();
-  read_TOC();  // Fetch result
+// Send a packet from RAM and wait until the device has either data ready or
+// finished. Blocking, only used while streaming audio sectors.
+void SendPac(const byte *pac, unsigned int limit) {
+  unsigned long start = millis();
+  unsigned long polls = wait_polls;
+  dev_select();
+  pac_issue(limit);
+  if (DRQ_set_wait()) {  // Device sets DRQ when it is ready for the packet
+    pac_send(pac);
+    BSY_clear_wait();
+  }
+  ide_stat = dataLval;  // A data phase starts with this status, see pio_start()
+  wait_record(poll_find(pac[0]), wait_polls - polls, millis() - start);
+  pio_stat_ok = true;
+  pio_left = 0;
 }
 
-void read_TOC() {
-  readIDE(DataReg);  // TOC Data Length not needed, don't care
-  readIDE(DataReg);  // Read first and last session
-  s_trck = dataLval;
-  e_trck = dataHval;
-  do {
-    readIDE(DataReg);  // Skip Session no. ADR and control fields
-    readIDE(DataReg);  // Read curent track number
-    c_trck = dataLval;
-    readIDE(DataReg);     // Read M
-    c_trck_m = dataHval;  // Store M of curent track
-    readIDE(DataReg);     // Read S and F
-    c_trck_s = dataLval;  // Store S of current track
-    c_trck_f = dataHval;  // Store F of current track
-
-    if (c_trck == s_trck) {  // Store MSF of first track
-      fnc[51] = c_trck_m;    //
-      fnc[52] = c_trck_s;
-      fnc[53] = c_trck_f;
+// ####################
+// ATAPI command engine
+// ####################
+
+// Commands wait in cmd_q[] until the device is free. cmd_poll() is called from loop()
+// and does at most one status read per call while the device is busy, every phase
+// has a timeout. A timed out command gets a DEVICE RESET and on_done(ST_TIMEOUT).
+// With -D IDE_INTRQ a command that executes is polled only when INTRQ rises, or
+// every INTRQ_BACKSTOP ms in case an edge got lost.
+
+// Queue the packet 'pac' from flash. on_data() and on_done() may be NULL.
+// Returns the queued copy, so run time fields can be filled in, or NULL if
+// the queue is full.
+byte *cmd_queue(const Packet *pac, boolean (*on_data)(byte step), void (*on_done)(byte stat)) {
+  if (drv->cmd_count == CMD_QUEUE) {
+    return NULL;
+  }
+  AtapiCmd *c = &drv->cmd_q[(drv->cmd_first + drv->cmd_count) % CMD_QUEUE];
+  memcpy_P(c->pac, pac, sizeof(c->pac));
+  c->on_data = on_data;
+  c->on_done = on_done;
+  c->btn = btn_open;
+  btn_open = false;
+  c->cfg = poll_find(c->pac[0]);
+  drv->cmd_count++;
+  return c->pac;
+}
+
+// Nothing queued for drv
+boolean cmd_idle() {
+  return drv->cmd_count == 0;
+}
+
+// Run the queues of all devices until they are empty. For setup() and the serial rip.
+void cmd_wait() {
+  for (byte i = 0; i < IDE_DEVICES; i++) {
+    while (drives[i].cmd_count) {
+      cmd_poll();
     }
-    if (c_trck == a_trck) {  // Store MSF of actual track
-      d_trck_m = c_trck_m;   //
-      d_trck_s = c_trck_s;
-      d_trck_f = c_trck_f;
+  }
+}
+
+// Choose the device whose command runs next. The queues take turns, starting
+// after the device that ran last, so one busy drive cannot hold off the other.
+boolean cmd_pick() {
+  for (byte i = 1; i <= IDE_DEVICES; i++) {
+    byte d = (cmd_dev + i) % IDE_DEVICES;
+    if (drives[d].cmd_count) {
+      cmd_dev = d;
+      return true;
     }
-    if (c_trck == 0xAA) {  // Store MSF of end position
-      fnc[54] = c_trck_m;
-      fnc[55] = c_trck_s;
-      fnc[56] = c_trck_f;
+  }
+  return false;
+}
+
+// Remove the running command from the queue and report its final status.
+void cmd_finish(byte stat) {
+  AtapiCmd *c = &drv->cmd_q[drv->cmd_first];
+  void (*done)(byte stat) = c->on_done;
+  bus_stat(c->pac[0], c->trans);
+  wait_record(c->cfg, wait_polls - cmd_polls, millis() - cmd_start);
+  drv->cmd_first = (drv->cmd_first + 1) % CMD_QUEUE;
+  drv->cmd_count--;
+  cmd_phase = CMD_IDLE;
+  if (done) {
+    done(stat);  // May queue follow-up commands
+  }
+}
+
+// Enter a new phase of the running command, the next status poll comes after 'ivl' ms
+void cmd_phase_to(byte phase, unsigned int ivl, unsigned long now) {
+  cmd_phase = phase;
+  cmd_since = now;
+  cmd_ivl = ivl;
+  cmd_next = now + ivl;
+}
+
+// Device selection only changes between commands: ATA wants BSY and DRQ clear on
+// the selected device before the DEV bit moves. A drive that holds BSY while it
+// seeks keeps the bus, START STOP UNIT is therefore sent with Immed set.
+void cmd_poll() {
+  if (cmd_phase == CMD_IDLE && !cmd_pick()) {
+    return;
+  }
+  Drive *ui = drv;
+  drv = &drives[cmd_dev];  // Callbacks see the device of their command
+  cmd_run();
+  drv = ui;
+}
+
+void cmd_run() {
+  AtapiCmd *c = &drv->cmd_q[drv->cmd_first];
+  PollCfg cfg;
+  memcpy_P(&cfg, &poll_cfg[c->cfg], sizeof(cfg));
+  unsigned long now = millis();
+
+  if (cmd_phase == CMD_IDLE) {
+    dev_select();
+    c->trans = bus_trans;
+    cmd_start = now;
+    cmd_polls = wait_polls;
+    cmd_phase_to(CMD_ISSUE, 0, now);
+  }
+  if (cmd_phase == CMD_DATA) {  // Data phase in steps, so loop() keeps running
+    if (c->on_data == NULL || c->on_data(cmd_step++)) {
+      drain_IDE();
+      cmd_phase_to(CMD_EXEC, 0, now);
     }
-    readIDE(ComSReg);
-  } while (dataLval & (1 << 3));  // Read data from DataRegister until DRQ=0
+    return;
+  }
+  if ((long)(now - cmd_next) < 0 && !intrq_seen) {  // Backing off
+    return;
+  }
+
+  intrq_seen = false;
+  readIDE(ComSReg);
+  wait_polls++;
+  byte stat = dataLval;
+  unsigned int limit = (cmd_phase == CMD_ISSUE) ? T_ISSUE
+                     : (cmd_phase == CMD_PACKET) ? T_PACKET : cfg.timeout;
+  if ((stat & (1 << 7)) || (cmd_phase == CMD_ISSUE && (stat & (1 << 3)))) {
+    if (now - cmd_since > limit) {  // Device hangs, reset it
+      writeIDE(ComSReg, 0x08, 0xFF);  // ATAPI DEVICE RESET
+      cmd_finish(ST_TIMEOUT);
+      return;
+    }
+    cmd_next = now + cmd_ivl;  // Still busy, poll less often
+    cmd_ivl = cmd_ivl ? min(cmd_ivl * 2, poll_max(c->cfg)) : 1;
+    return;
+  }
+
+  switch (cmd_phase) {
+    case CMD_ISSUE:
+      pac_issue(drv->cap.byte_limit);
+      cmd_phase_to(CMD_PACKET, DRQ_FIRST_POLL[drv->cap.drq], now);
+      break;
+    case CMD_PACKET:
+      if (!(stat & (1 << 3))) {  // Device refused the packet
+        cmd_finish(stat);
+        break;
+      }
+      pac_send(c->pac);
+      lat_stat(c->btn);
+#ifdef IDE_INTRQ
+      cmd_phase_to(CMD_EXEC, INTRQ_BACKSTOP, now);
+#else
+      cmd_phase_to(CMD_EXEC, cfg.first, now);
+#endif
+      break;
+    case CMD_EXEC:
+      if (stat & (1 << 3)) {  // Data phase, see pio_start()
+        ide_stat = stat;
+        pio_stat_ok = true;
+        pio_left = 0;
+        cmd_step = 0;
+        cmd_phase = CMD_DATA;
+      } else {
+        cmd_finish(stat);
+      }
+  }
+}
+
+// Longest pause between status polls in the current phase. DRQ for the packet
+// raises no INTRQ, so only the execution waits for the interrupt.
+unsigned int poll_max(byte cfg) {
+#ifdef IDE_INTRQ
+  if (cmd_phase == CMD_EXEC) {
+    return INTRQ_BACKSTOP;
+  }
+#endif
+  return pgm_read_byte(&poll_cfg[cfg].max);
+}
+
+// ############################
+// Status polling statistics
+// ############################
+
+// Index of the poll_cfg[] entry for a packet opcode
+byte poll_find(byte opcode) {
+  byte i = 0;
+  while (i < POLL_CFGS - 1 && pgm_read_byte(&poll_cfg[i].opcode) != opcode) {
+    i++;
+  }
+  return i;
+}
+
+// Account one finished command: status reads spent and total duration
+void wait_record(byte cfg, unsigned int polls, unsigned long ms) {
+  WaitStat *w = &wait_stat[cfg];
+  byte b = 0;
+  for (unsigned long lim = 2; ms >= lim && b < 7; lim <<= 2) {
+    b++;
+  }
+  if (w->hist[b] < 255) {
+    w->hist[b]++;
+  }
+  w->cmds++;
+  w->polls += polls;
+  if (ms > w->max_ms) {
+    w->max_ms = ms > 0xFFFF ? 0xFFFF : ms;
+  }
+}
+
+// One line per opcode seen: OP CMDS POLLS MAXMS and the duration histogram
+void wait_dump() {
+  Serial.println(F("OP N POLLS MAX <2 <8 <32 <128 <512 <2k <8k >"));
+  for (byte i = 0; i < POLL_CFGS; i++) {
+    WaitStat *w = &wait_stat[i];
+    if (w->cmds == 0) {
+      continue;
+    }
+    Serial.print(pgm_read_byte(&poll_cfg[i].opcode), HEX);
+    Serial.print(' ');
+    Serial.print(w->cmds);
+    Serial.print(' ');
+    Serial.print(w->polls);
+    Serial.print(' ');
+    Serial.print(w->max_ms);
+    for (byte b = 0; b < 8; b++) {
+      Serial.print(' ');
+      Serial.print(w->hist[b]);
+    }
+    Serial.println();
+  }
+}
+
+// Track the time from a button press to its first packet (build with -D LATENCY_STATS).
+void lat_stat(boolean btn) {
+  if (!btn) {
+    return;
+  }
+  unsigned long lat = millis() - btn_millis;
+  if (lat > lat_max) {
+    lat_max = lat;
+  }
+#ifdef LATENCY_STATS
+  Serial.print(F("LAT "));
+  Serial.print(lat);
+  Serial.print(F(" max "));
+  Serial.println(lat_max);
+#endif
+}
+
+// ###################################
+// Auxiliary functions PIO data blocks
+// ###################################
+
+// Start the next DRQ block of the running command and fetch its byte count
+// from CylL/CylH. Returns false when the device has no more data to send.
+boolean pio_start() {
+  if (!pio_stat_ok) {
+    BSY_clear_wait();  // On timeout BSY is still set in ide_stat, so no DRQ
+    ide_stat = dataLval;
+  }
+  pio_stat_ok = false;
+  if (!(ide_stat & (1 << 3))) {
+    pio_left = 0;
+    return false;
+  }
+  readIDE(CylLReg);
+  pio_left = dataLval;
+  readIDE(CylHReg);
+  pio_left |= (unsigned int)dataLval << 8;
+  pio_left = (pio_left + 1) & ~1;  // An odd count still transfers a whole last word
+  return true;
+}
+
+// Read one data word. The Data register stays selected, only nDIOR is toggled.
+void pio_word() {
+  unsigned int w = bus_read_next(DataReg);
+  dataLval = lowByte(w);
+  dataHval = highByte(w);
+  pio_left -= 2;
+}
+
+// Read 'len' bytes (even) of the data phase into buf, crossing DRQ blocks as needed.
+// Status is only checked at block boundaries. Returns the number of bytes stored,
+// less than len if the device ended the transfer early.
+unsigned int readIDE_block(byte *buf, unsigned int len) {
+  unsigned int n = 0;
+  while (n < len) {
+    if (pio_left == 0 && !pio_start()) {
+      break;
+    }
+    pio_word();
+    buf[n++] = dataLval;  // Data arrives little endian
+    buf[n++] = dataHval;
+  }
+  return n;
+}
+
+// Discard whatever the device still has to send.
+void drain_IDE() {
+  while (pio_left != 0 || pio_start()) {
+    pio_word();
+  }
+}
+
+void get_TOC(void (*done)(byte stat)) {
+  cmd_queue(&PAC_TOC, read_TOC, done);  // Queue read TOC command packet
+}
+
+// Data phase of READ TOC: the header first, then one track descriptor per step.
+// Fills toc_tab[] and toc_lead, which stay valid until eject, load or a media change.
+boolean read_TOC(byte step) {
+  byte buf[8];
+  if (step == 0) {
+    for (byte i = 0; i < IDE_DEVICES; i++) {  // toc_tab[] changes hands
+      drives[i].toc_valid = false;
+    }
+    if (readIDE_block(buf, 4) < 4) {  // TOC Data Length not needed, don't care
+      return true;
+    }
+    drv->s_trck = buf[2];  // First and last track
+    drv->e_trck = buf[3];
+    return false;
+  }
+  if (readIDE_block(buf, 8) < 8) {  // One track descriptor per 8 bytes
+    return true;
+  }
+  TocEntry *t;
+  if (buf[2] == 0xAA) {  // Lead-out, end of the last track
+    t = &drv->toc_lead;
+    drv->toc_valid = (drv->s_trck >= 1 && drv->e_trck <= MAX_TRACKS && drv->s_trck <= drv->e_trck);
+  } else if (buf[2] >= 1 && buf[2] <= MAX_TRACKS) {
+    t = &toc_tab[buf[2] - 1];
+  } else {
+    return false;
+  }
+  t->ctrl = buf[1];
+  t->m = buf[5];  // MSF of current track
+  t->s = buf[6];
+  t->f = buf[7];
+  if (buf[2] == drv->s_trck) {  // Store MSF of first track
+    drv->play_msf[0] = t->m;    // as play start position
+    drv->play_msf[1] = t->s;
+    drv->play_msf[2] = t->f;
+  }
+  if (buf[2] == 0xAA) {  // Store MSF of lead-out
+    drv->play_msf[3] = t->m;  // as play end position
+    drv->play_msf[4] = t->s;
+    drv->play_msf[5] = t->f;
+  }
+  return false;
 }
 
 void read_subch_cmd() {
-  idx = 144;               // Pointer to read Subchannel Packet
-  SendPac();               // Send read Subchannel command packet
-  readIDE(DataReg);        // Get Audio Status
-  if (dataHval == 0x13) {  // Play operation successfully completed
-    dataHval = 0x15;       // means drive is neither paused nor in play
-  }                        // so treat as stopped
-  if (dataHval == 0x11 ||   // playing
-      dataHval == 0x12 ||   // paused
-      dataHval == 0x15)    // stopped
+  cmd_queue(&PAC_SUBCH, read_subch, subch_done);  // Queue read Subchannel command packet
+}
+
+boolean read_subch(byte step) {
+  byte buf[16];
+  if (readIDE_block(buf, 16) < 16) {
+    buf[1] = 0;            // No reply is treated like "NO DISC"
+  }
+  if (buf[1] == 0x13) {  // Play operation successfully completed
+    buf[1] = 0x15;       // means drive is neither paused nor in play
+  }                      // so treat as stopped
+  if (drv->parked && buf[1] == 0x15) {  // Parked by seek_ahead(), still paused to the user
+    return true;
+  }
+  if (buf[1] == 0x11 ||   // playing
+      buf[1] == 0x12 ||   // paused
+      buf[1] == 0x15)    // stopped
   {
-    aud_stat = dataHval;  //
+    if (drv->aud_stat != buf[1]) {
+      drv->stat_since = millis();
+    }
+    drv->aud_stat = buf[1];  // Audio Status
+    drv->a_trck = buf[6];    // actual track
+    drv->MFS_M = buf[9];     // M and S fields of absolute MSF address
+    drv->MFS_S = buf[10];
+    memcpy(drv->abs_msf, buf + 9, 3);  // For subch_ivl() and resume()
   } else {
-    aud_stat = 0;  // all other values will report "NO DISC"
-  }
-  readIDE(DataReg);  // Get (ignore) Subchannel Data Length
-  readIDE(DataReg);  // Get (ignore) Format Code, ADR and Control
-  readIDE(DataReg);  // Get actual track
-  a_trck = dataLval;
-  readIDE(DataReg);  // Get M field of actual MFS data and
-  MFS_M = dataHval;  // store M it
-  readIDE(DataReg);  // get S and F fields
-  MFS_S = dataLval;  // Store S value
-  do {
-    readIDE(DataReg);
-    readIDE(ComSReg);
-  } while (dataLval & (1 << 3));  // Read rest of data from Data Reg. until DRQ=0
-}
-
-byte chck_disk() {
-  byte disk_ok = 0xFF;  // assume no valid disk present.
-  idx = 128;            // Send mode sense packet
-  SendPac();            //
-  delay(10);
-  DRQ_set_wait();    // Wait for data ready to read.
-  readIDE(DataReg);  // Read and discard Mode Sense data length
-  readIDE(DataReg);  // Get Medium Type byte
-                     // If valid audio disk present disk_ok=0x00
-  if (dataLval == 0x02 || dataLval == 0x06 || dataLval == 0x12 || 
-      dataLval == 0x16 || dataLval == 0x22 || dataLval == 0x26) {
-    disk_ok = 0x00;
-  }
-  if (dataLval == 0x71) {  // Note if door open
-    disk_ok = 0x71;
-  }
-  do {  // Skip rest of packet
-    readIDE(DataReg);
-    readIDE(ComSReg);
-  } while (dataLval & (1 << 3));
-  return (disk_ok);
+    drv->aud_stat = 0;  // all other values will report "NO DISC"
+  }
+  return true;
 }
 
-void unit_ready() {  // Reuests unit to report status
-  idx = 112;         // used to check_unit_ready
-  SendPac();
+void chck_disk(void (*done)(byte stat)) {
+  drv->disk_ok = 0xFF;                        // assume no valid disk present.
+  cmd_queue(&PAC_MEDIUM, read_medium, done);  // Send mode sense packet
 }
 
-void req_sense() {  // Request Sense Command is used to check
-  idx = 160;        // the result of the Unit Ready command.
-  SendPac();        // The Additional Sense Code is used,
-  delay(10);        // see table 71 in sff8020i documentation
-  DRQ_set_wait();
-  cnt = 0;
-  do {
-    readIDE(DataReg);
-    if (cnt == 6) {
-      asc = dataLval;  // Store Additional Sense Code
-    }
-    cnt++;
-    readIDE(AStCReg);
-    readIDE(ComSReg);
-  } while (dataLval & (1 << 3));  // Skip rest of packet
+boolean read_medium(byte step) {
+  byte buf[8];  // Mode parameter header only
+  if (readIDE_block(buf, 8) < 8) {
+    return true;
+  }
+  byte medium = buf[2];  // Medium Type byte
+                         // If valid audio disk present disk_ok=0x00
+  if (medium == 0x02 || medium == 0x06 || medium == 0x12 ||
+      medium == 0x16 || medium == 0x22 || medium == 0x26) {
+    drv->disk_ok = 0x00;
+  }
+  if (medium == 0x71) {  // Note if door open
+    drv->disk_ok = 0x71;
+  }
+  return true;
+}
+
+void unit_ready() {            // Reuests unit to report status
+  cmd_queue(&PAC_READY, NULL, NULL);  // used to check_unit_ready
+}
+
+void req_sense() {                    // Request Sense Command is used to check
+  cmd_queue(&PAC_SENSE, read_sense, NULL);   // the result of the Unit Ready command.
+}                                     // The Additional Sense Code is used,
+                                      // see table 71 in sff8020i documentation
+boolean read_sense(byte step) {
+  byte buf[18];
+  if (readIDE_block(buf, 18) >= 14) {
+    drv->asc = buf[12];  // Store Additional Sense Code
+  }
+  if (drv->asc == 0x28 || drv->asc == 0x29 || drv->asc == 0x3A) {  // Medium may have changed,
+    drv->toc_valid = false;                                              // power on/reset or no medium
+  }
+  return true;
 }
 
 void init_task_file() {
   writeIDE(ErrFReg, 0x00, 0xFF);  // Set Feature register = 0 (no overlapping and no DMA)
-  writeIDE(CylHReg, 0x02, 0xFF);  // Set PIO buffer to max. transfer length (= 200h)
-  writeIDE(CylLReg, 0x00, 0xFF);
-  writeIDE(AStCReg, 0x02, 0xFF);  // Set nIEN, we don't care about the INTRQ signal
+  set_byte_count(drv->cap.byte_limit);  // Largest PIO block the drive takes
+  writeIDE(AStCReg, DEV_CTRL, 0xFF);  // nIEN set unless built with -D IDE_INTRQ
   BSY_clear_wait();               // When conditions are met then IDE bus is idle,
   DRQ_clear_wait();               // this check may not be necessary (???)
 }
 
+// Set the byte count limit the device uses to size its DRQ blocks
+void set_byte_count(unsigned int len) {
+  writeIDE(CylHReg, highByte(len), 0xFF);
+  writeIDE(CylLReg, lowByte(len), 0xFF);
+}
+
 void checkDeviceStatus() {
   readIDE(ComSReg);
   byte status = dataLval;
   
-  if(status & (1 << 0)) Serial.println("Error bit set");
-  if(status & (1 << 7)) Serial.println("Busy bit set");
-  if(status & (1 << 6)) Serial.println("Drive Ready");
-  if(status & (1 << 3)) Serial.println("Data Request set");
-  if(status & (1 << 4)) Serial.println("Seek complete");
+  if(status & (1 << 0)) Serial.println(F("Error bit set"));
+  if(status & (1 << 7)) Serial.println(F("Busy bit set"));
+  if(status & (1 << 6)) Serial.println(F("Drive Ready"));
+  if(status & (1 << 3)) Serial.println(F("Data Request set"));
+  if(status & (1 << 4)) Serial.println(F("Seek complete"));
   
   // Read error register if error bit is set
   if(status & (1 << 0)) {
     readIDE(ErrFReg);
-    Serial.print("Error register: 0x");
+    Serial.print(F("Error register: 0x"));
     Serial.println(dataLval, HEX);
   }
 }
 
+// ##########################################
+// Digital audio extraction over the serial line
+// ##########################################
+
+// The host sends 'R'. The serial line switches to DAE_BAUD and every sector of the
+// disc goes out as one frame of type 'S' (LBA, 4 bytes LE, then 2352 bytes of audio).
+// A final frame of type 'E' carries sectors sent, milliseconds taken and an error flag.
+// Afterwards the line returns to SERIAL_BAUD.
+
+unsigned int crc16_update(unsigned int crc, byte b) {  // CRC-16/CCITT, poly 0x1021
+  crc ^= (unsigned int)b << 8;
+  for (byte i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+long msf_to_lba(byte m, byte s, byte f) {
+  return ((long)m * 60 + s) * 75 + f - 150;
+}
+
+// Move what the UART can take without blocking from dae_ring to the serial port.
+void dae_pump() {
+  while (dae_used && Serial.availableForWrite() > 0) {
+    Serial.write(dae_ring[dae_tail]);
+    dae_tail = (dae_tail + 1) % sizeof(dae_ring);
+    dae_used--;
+  }
+}
+
+// True if 'len' more bytes fit into dae_ring, after moving what the UART takes.
+boolean dae_room(unsigned int len) {
+  dae_pump();
+  return sizeof(dae_ring) - dae_used >= len;
+}
+
+// Wait until 'len' more bytes fit into dae_ring. Only the rip waits, it has the
+// serial line to itself.
+void dae_wait(unsigned int len) {
+  while (!dae_room(len)) {
+  }
+}
+
+// Queue bytes for the UART without waiting. Bytes that do not fit are dropped
+// and counted, callers check dae_room() first.
+void dae_put(const byte *buf, byte len) {
+  for (byte i = 0; i < len; i++) {
+    if (dae_used == sizeof(dae_ring)) {
+      dae_overruns++;
+      continue;
+    }
+    dae_ring[dae_head] = buf[i];
+    dae_head = (dae_head + 1) % sizeof(dae_ring);
+    dae_used++;
+  }
+  dae_pump();
+}
+
+// Frame body bytes also go into the running CRC
+void dae_body(const byte *buf, byte len) {
+  for (byte i = 0; i < len; i++) {
+    dae_crc = crc16_update(dae_crc, buf[i]);
+  }
+  dae_put(buf, len);
+}
+
+void dae_frame_start(byte type, unsigned int len) {
+  byte hdr[5] = { DAE_SYNC1, DAE_SYNC2, type, lowByte(len), highByte(len) };
+  dae_put(hdr, 2);
+  dae_crc = 0xFFFF;
+  dae_body(hdr + 2, 3);
+}
+
+void dae_frame_end() {
+  byte crc[2] = { lowByte(dae_crc), highByte(dae_crc) };
+  dae_put(crc, 2);
+}
+
+// Stream 'n' sectors of the running READ CD command. Each DAE_CHUNK read from the
+// bus is handed to the UART right away, so the bus never waits for the serial line.
+// Returns the number of complete sectors sent.
+byte dae_sectors(long lba, byte n) {
+  byte buf[DAE_CHUNK];
+  for (byte sec = 0; sec < n; sec++, lba++) {
+    dae_wait(DAE_HEADER + 4);
+    dae_frame_start('S', CD_RAW + 4);
+    byte addr[4] = { (byte)lba, (byte)(lba >> 8), (byte)(lba >> 16), (byte)(lba >> 24) };
+    dae_body(addr, 4);
+    for (unsigned int done = 0; done < CD_RAW; done += DAE_CHUNK) {
+      byte len = min((unsigned int)DAE_CHUNK, CD_RAW - done);
+      if (readIDE_block(buf, len) < len) {
+        return sec;  // Device ended the transfer early, frame stays incomplete
+      }
+      dae_wait(len);
+      dae_body(buf, len);
+    }
+    dae_wait(DAE_TRAILER);
+    dae_frame_end();
+  }
+  return n;
+}
+
+void rip_disc() {
+  cmd_wait();  // SendPac() below needs the device to itself
+  if (!drv->toc_valid) {
+    get_TOC(NULL);
+    cmd_wait();
+  }
+  long lba = 0;
+  long end = 0;
+  if (drv->toc_valid) {  // From the first track to the lead-out
+    TocEntry *t = &toc_tab[drv->s_trck - 1];
+    lba = msf_to_lba(t->m, t->s, t->f);
+    end = msf_to_lba(drv->toc_lead.m, drv->toc_lead.s, drv->toc_lead.f);
+  }
+  unsigned long sent = 0;
+  boolean ok = drv->toc_valid;  // No disc or no TOC: an empty rip with the error flag set
+
+  while (dae_used) {  // Frames of the host link still queued
+    dae_pump();
+  }
+  Serial.flush();
+  Serial.begin(DAE_BAUD);
+  dae_head = dae_tail = dae_used = 0;
+  unsigned long start = millis();
+
+  byte pac[PAC_LEN];
+  memcpy_P(pac, &PAC_READ_CD, PAC_LEN);
+  unsigned int limit = drv->cap.byte_limit / CD_RAW * CD_RAW;  // Whole sectors per DRQ block
+  if (limit == 0) {
+    limit = CD_RAW;
+  }
+  while (ok && lba < end) {
+    byte n = (end - lba < DAE_BURST) ? (byte)(end - lba) : DAE_BURST;
+    pac[READ_CD_LBA] = (byte)(lba >> 24);  // Starting LBA
+    pac[READ_CD_LBA + 1] = (byte)(lba >> 16);
+    pac[READ_CD_LBA + 2] = (byte)(lba >> 8);
+    pac[READ_CD_LBA + 3] = (byte)lba;
+    pac[READ_CD_LEN] = n;                  // Transfer length in sectors
+    SendPac(pac, limit);
+    byte got = (ide_stat & (1 << 0)) ? 0 : dae_sectors(lba, n);  // ERR set -> nothing to read
+    drain_IDE();
+    ok = (got == n);
+    lba += n;
+    sent += got;
+  }
+
+  unsigned long ms = millis() - start;
+  byte stats[9] = { (byte)sent, (byte)(sent >> 8), (byte)(sent >> 16), (byte)(sent >> 24),
+                    (byte)ms, (byte)(ms >> 8), (byte)(ms >> 16), (byte)(ms >> 24), !ok };
+  dae_wait(DAE_HEADER + sizeof(stats) + DAE_TRAILER);
+  dae_frame_start('E', sizeof(stats));
+  dae_body(stats, sizeof(stats));
+  dae_frame_end();
+  while (dae_used) {
+    dae_pump();
+  }
+
+  Serial.flush();
+  Serial.begin(SERIAL_BAUD);
+  Serial.print(F("DAE "));
+  Serial.print(sent);
+  Serial.print(F(" sect "));
+  Serial.print(ms ? sent * 1000.0 / ms : 0.0);
+  Serial.println(F("/s"));
+  drv->toc = false;
+}
+
+// #########
+// Host link
+// #########
+
+// With -D HOST_LINK a host process drives the player over the serial line in
+// frames as used for DAE, see dae_frame_start(). The controller sends
+//
+//   'T' status, only when a field changed: aud_stat a_trck M S s_trck e_trck
+//       lead-out M S F, 1 if the TOC fields are valid and the device shown
+//   'A' reply to a command: command byte, 1 if it was accepted
+//
+// The host sends 'C' frames with a command byte and an argument byte:
+//
+//   'P' play or resume   'Z' pause   'S' stop   'E' open or close the tray
+//   'N' play track <arg>   'D' show and control device <arg>, 0 master 1 slave
+//
+// Bytes outside frames are setup() text and the 'R', 'H' and 'B' requests.
+#ifdef HOST_LINK
+
+byte link_sent[LINK_STATUS];  // Payload of the last 'T' frame
+byte link_state;              // Receiver position within the frame, 0 = hunting for sync
+byte link_type;
+unsigned int link_len;
+unsigned int link_pos;
+unsigned int link_crc;
+byte link_buf[LINK_MAX];
+unsigned int link_drops;      // Frames not sent because dae_ring had no room
+
+// Queue a whole frame for the host, or drop it if dae_ring has no room for it,
+// so the command engine never waits for the serial line
+boolean link_frame(byte type, const byte *buf, byte len) {
+  if (!dae_room(DAE_HEADER + len + DAE_TRAILER)) {
+    link_drops++;
+    return false;
+  }
+  dae_frame_start(type, len);
+  dae_body(buf, len);
+  dae_frame_end();
+  return true;
+}
+
+// Take one received byte. Returns it if it is not part of a frame, else -1.
+int link_rx(int c) {
+  if (c < 0) {
+    return c;
+  }
+  switch (link_state) {
+    case 0:
+      if (c != DAE_SYNC1) {
+        return c;
+      }
+      link_state = 1;
+      break;
+    case 1:
+      if (c == DAE_SYNC2) {
+        link_state = 2;
+      } else if (c != DAE_SYNC1) {  // Another DAE_SYNC1 may start the real frame
+        link_state = 0;
+      }
+      break;
+    case 2:
+      link_type = c;
+      link_crc = crc16_update(0xFFFF, c);
+      link_state = 3;
+      break;
+    case 3:
+      link_len = c;
+      link_crc = crc16_update(link_crc, c);
+      link_state = 4;
+      break;
+    case 4:
+      link_len |= (unsigned int)c << 8;
+      link_crc = crc16_update(link_crc, c);
+      link_pos = 0;
+      link_state = (link_len > LINK_MAX) ? 0 : (link_len ? 5 : 6);  // Too long is noise
+      break;
+    case 5:
+      link_buf[link_pos++] = c;
+      link_crc = crc16_update(link_crc, c);
+      if (link_pos == link_len) {
+        link_state = 6;
+      }
+      break;
+    case 6:
+      link_state = (c == lowByte(link_crc)) ? 7 : 0;
+      break;
+    case 7:
+      link_state = 0;
+      if (c == highByte(link_crc)) {
+        link_cmd();
+      }
+  }
+  return -1;
+}
+
+// Carry out a command frame and answer with an 'A' frame
+void link_cmd() {
+  if (link_type != 'C' || link_len < 2) {
+    return;
+  }
+  byte reply[2] = { link_buf[0], 1 };
+  drv->poll_ivl = POLL_FAST;  // Report what the command did soon
+  switch (link_buf[0]) {
+    case 'P':
+      if (drv->aud_stat == 0x15) {
+        play();
+      } else if (drv->aud_stat == 0x12) {
+        resume();
+      } else {
+        reply[1] = 0;
+      }
+      drv->toc = false;
+      break;
+    case 'Z':
+      if (drv->aud_stat == 0x11) {
+        pause();
+      } else {
+        reply[1] = 0;
+      }
+      break;
+    case 'S':
+      stop_all();
+      break;
+    case 'E':
+      tray();
+      break;
+    case 'D':
+      if (link_buf[1] < IDE_DEVICES && drives[link_buf[1]].present) {
+        dev_show(link_buf[1]);
+      } else {
+        reply[1] = 0;
+      }
+      break;
+    case 'N':
+      if (drv->toc_valid && link_buf[1] >= drv->s_trck && link_buf[1] <= drv->e_trck) {
+        drv->a_trck = link_buf[1];
+        play_track();
+      } else {
+        reply[1] = 0;
+      }
+      break;
+    default:
+      reply[1] = 0;
+  }
+  link_frame('A', reply, sizeof(reply));
+}
+
+// Send a 'T' frame if the status differs from the last one sent
+void link_status() {
+  byte st[LINK_STATUS] = { drv->aud_stat, drv->a_trck, drv->MFS_M, drv->MFS_S };
+  if (drv->toc_valid) {
+    st[4] = drv->s_trck;
+    st[5] = drv->e_trck;
+    st[6] = drv->toc_lead.m;
+    st[7] = drv->toc_lead.s;
+    st[8] = drv->toc_lead.f;
+    st[9] = 1;
+  }
+  st[10] = ui_dev;
+  if (memcmp(st, link_sent, sizeof(st)) == 0) {
+    return;
+  }
+  if (link_frame('T', st, sizeof(st))) {  // Tried again next loop() if dropped
+    memcpy(link_sent, st, sizeof(st));
+  }
+}
+
+#endif
+
 // END ####################################################################################
@@ -1,16 +1,26 @@
-#include <Arduino.h> 
+#include <Arduino.h>
+#include "packets.h"
 
-void highZ();
+void bus_stat(byte opcode, unsigned long start);
+void bus_bench();
+void bench_toc();
+void bench_subch();
+void bench_medium();
+void bench_ops();
 void reset_IDE();
-void BSY_clear_wait();
-void DRY_set_wait();
+boolean BSY_clear_wait();
+boolean DRY_set_wait();
 void readIDE(byte regval);
 void writeIDE(byte regval, byte dataLval, byte dataHval);
 void init_task_file();
-void DRQ_clear_wait();
+boolean DRQ_clear_wait();
+boolean DRQ_set_wait();
+boolean stat_wait(byte mask, byte want, unsigned int timeout);
 void unit_ready();
 void req_sense();
-byte chck_disk();
+void chck_disk(void (*done)(byte stat));
+boolean read_medium(byte step);
+boolean read_sense(byte step);
 void eject();
 void load();
 void play();
@@ -18,9 +28,68 @@ void stop();
 void resume();
 void stop_disk();
 void pause();
-void get_TOC();
+void get_TOC(void (*done)(byte stat));
 void read_subch_cmd();
+boolean read_subch(byte step);
 void curr_MSF();
 void Disp_CD_data();
-void SendPac();
-void read_TOC();
\ No newline at end of file
+void SendPac(const byte *pac, unsigned int limit);
+void pac_issue(unsigned int limit);
+void pac_send(const byte *pac);
+boolean read_TOC(byte step);
+boolean pio_start();
+void pio_word();
+unsigned int readIDE_block(byte *buf, unsigned int len);
+void drain_IDE();
+void set_byte_count(unsigned int len);
+unsigned int crc16_update(unsigned int crc, byte b);
+long msf_to_lba(byte m, byte s, byte f);
+void dae_pump();
+boolean dae_room(unsigned int len);
+void dae_wait(unsigned int len);
+void dae_put(const byte *buf, byte len);
+void dae_body(const byte *buf, byte len);
+void dae_frame_start(byte type, unsigned int len);
+void dae_frame_end();
+byte dae_sectors(long lba, byte n);
+void rip_disc();
+byte *cmd_queue(const Packet *pac, boolean (*on_data)(byte step), void (*on_done)(byte stat));
+boolean cmd_idle();
+void cmd_wait();
+void cmd_finish(byte stat);
+void cmd_poll();
+void cmd_run();
+boolean cmd_pick();
+void dev_select();
+void dev_detect();
+boolean dev_identifies();
+void dev_setup();
+void id_parse(unsigned int i, unsigned int w);
+void id_show();
+void dev_next();
+void dev_show(byte i);
+boolean on_display();
+void lat_stat(boolean btn);
+boolean pressed(byte pin);
+void eject_done(byte stat);
+void skip_done(byte stat);
+void subch_done(byte stat);
+void subch_show();
+unsigned int subch_ivl();
+void seek_ahead();
+void toc_done(byte stat);
+void play_track();
+void cmd_phase_to(byte phase, unsigned int ivl, unsigned long now);
+byte poll_find(byte opcode);
+void wait_record(byte cfg, unsigned int polls, unsigned long ms);
+void wait_dump();
+void intrq_sleep(byte ms);
+void intrq_isr();
+unsigned int poll_max(byte cfg);
+void tray();
+void stop_all();
+void disp(const __FlashStringHelper *msg);
+boolean link_frame(byte type, const byte *buf, byte len);
+int link_rx(int c);
+void link_cmd();
+void link_status();
@@ -0,0 +1,74 @@
+// ATAPI command packets, see sff8020i chapter 10. Every builder is a constant
+// expression, so a packet can be defined in flash with PROGMEM and copied to RAM
+// only when queued. Fields that change at run time (MSF, LBA) are left zero and
+// filled in through the offsets below.
+
+#ifndef PACKETS_H
+#define PACKETS_H
+
+#include <Arduino.h>
+
+const byte PAC_LEN = 12;  // Command bytes, 16 byte devices get 4 zeros after them
+
+struct Packet {
+  byte b[PAC_LEN];
+};
+
+// Field offsets for the parts filled in at send time
+const byte PLAY_START = 3;  // PLAY AUDIO MSF: starting M, S, F
+const byte PLAY_END = 6;    // PLAY AUDIO MSF: ending M, S, F
+const byte READ_CD_LBA = 2; // READ CD: starting LBA, big endian
+const byte READ_CD_LEN = 8; // READ CD: transfer length in sectors, low byte
+const byte SEEK_LBA = 2;    // SEEK: LBA, big endian
+
+constexpr Packet test_unit_ready() {
+  return { { 0x00, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } };
+}
+
+constexpr Packet request_sense(byte alloc) {
+  return { { 0x03, 0, 0, 0, alloc, 0, 0, 0, 0, 0, 0, 0 } };
+}
+
+// LoEj with Start clear opens the tray, with Start set closes it
+constexpr Packet start_stop_unit(boolean loej, boolean start, boolean immed = false) {
+  return { { 0x1B, (byte)(immed ? 0x01 : 0), 0, 0, (byte)((loej ? 0x02 : 0) | (start ? 0x01 : 0)), 0, 0, 0, 0, 0, 0, 0 } };
+}
+
+// Sub-Q channel data in format 'format', addresses as MSF
+constexpr Packet read_subchannel(byte format, byte alloc) {
+  return { { 0x42, 0x02, 0x40, format, 0, 0, 0, 0, alloc, 0, 0, 0 } };
+}
+
+// TOC format 0, addresses as MSF
+constexpr Packet read_toc(unsigned int alloc) {
+  return { { 0x43, 0x02, 0, 0, 0, 0, 0, highByte(alloc), lowByte(alloc), 0, 0, 0 } };
+}
+
+// SEEK(10), moves the pickup and ends any audio play or pause
+constexpr Packet seek() {
+  return { { 0x2B, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } };
+}
+
+constexpr Packet play_audio_msf() {
+  return { { 0x47, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } };
+}
+
+constexpr Packet pause_resume(boolean resume) {
+  return { { 0x4B, 0, 0, 0, 0, 0, 0, 0, (byte)(resume ? 0x01 : 0), 0, 0, 0 } };
+}
+
+constexpr Packet stop_play_scan() {
+  return { { 0x4E, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } };
+}
+
+constexpr Packet mode_sense(byte page, byte alloc) {
+  return { { 0x5A, 0, page, 0, 0, 0, 0, 0, alloc, 0, 0, 0 } };
+}
+
+// Sectors of type 'type' (bits 4-2 of byte 1), 'fields' selects what is
+// transferred per sector, 0x10 is user data only
+constexpr Packet read_cd(byte type, byte fields) {
+  return { { 0xBE, (byte)(type << 2), 0, 0, 0, 0, 0, 0, 0, fields, 0, 0 } };
+}
+
+#endif
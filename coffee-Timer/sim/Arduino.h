@@ -0,0 +1,163 @@
+// Minimal Arduino API and ATmega328P registers for building the firmware as a
+// Linux program. Time is simulated, see sim.h. Serial output goes to stdout.
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binary.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define F_CPU 16000000UL
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define F(s) (s)
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+
+#define bit(b) (1UL << (b))
+#define lowByte(w) ((uint8_t)((w) & 0xFF))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(x, lo, hi) ((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t level);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+char *itoa(int value, char *buf, int base);  // From avr-libc
+
+// Registers
+// #########
+
+// PORTD drives the display, each write goes to the model of the 74HC595s
+class SimPortD {
+ public:
+  operator uint8_t() const { return val; }
+  SimPortD &operator=(uint8_t v);
+  SimPortD &operator|=(uint8_t v) { return *this = val | v; }
+  SimPortD &operator&=(uint8_t v) { return *this = val & v; }
+
+ private:
+  uint8_t val;
+};
+
+// Interrupt flag registers: writing a one clears the flag
+class SimFlags {
+ public:
+  operator uint8_t() const { return flags; }
+  SimFlags &operator=(uint8_t v) {
+    flags &= ~v;
+    return *this;
+  }
+
+  uint8_t flags;
+};
+
+extern SimPortD PORTD;
+extern volatile uint8_t PORTB, DDRB, DDRD, PINB, PIND;
+extern volatile uint8_t SREG, SMCR, MCUCR, ADCSRA;
+extern volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+extern volatile uint16_t TCNT1, OCR1A;
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, TIMSK2;
+extern SimFlags PCIFR, TIFR1, TIFR2;
+
+// Bits used by the firmware
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIF2 2
+#define WGM12 3
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define OCIE1A 1
+#define OCF1A 1
+#define WGM21 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define OCIE2A 1
+#define OCF2A 1
+#define SE 0
+#define SM1 2
+#define SREG_I 7
+
+// Pin mapping of the Uno: 0-7 PORTD, 8-13 PORTB
+#define PB 2
+#define PD 4
+#define digitalPinToPort(p) ((p) < 8 ? PD : PB)
+#define digitalPinToBitMask(p) ((uint8_t)bit((p) < 8 ? (p) : (p) - 8))
+#define portInputRegister(port) ((port) == PD ? &PIND : &PINB)
+#define digitalPinToPCICRbit(p) ((p) < 8 ? PCIE2 : PCIE0)
+#define digitalPinToPCMSK(p) ((p) < 8 ? &PCMSK2 : &PCMSK0)
+#define digitalPinToPCMSKbit(p) ((p) < 8 ? (p) : (p) - 8)
+
+// Interrupts
+// ##########
+
+// Vectors are plain functions, called by the simulator while time passes
+#define ISR(vector) extern "C" void vector()
+
+// Pending interrupts are taken the next time simulated time advances
+#define cli() (SREG &= ~bit(SREG_I))
+#define sei() (SREG |= bit(SREG_I))
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+// Serial
+// ######
+
+class SimSerial {
+ public:
+  void begin(long baud);
+  void end() {}
+  void flush();
+  int availableForWrite();
+  size_t write(uint8_t b);
+  size_t write(const uint8_t *buf, size_t len);
+
+  void print(const char *s);
+  void print(char c);
+  void print(unsigned char n, int base = DEC) { print((unsigned long)n, base); }
+  void print(int n, int base = DEC) { print((long)n, base); }
+  void print(unsigned int n, int base = DEC) { print((unsigned long)n, base); }
+  void print(long n, int base = DEC);
+  void print(unsigned long n, int base = DEC);
+
+  template <typename T>
+  void println(T v) { print(v); println(); }
+  template <typename T>
+  void println(T v, int fmt) { print(v, fmt); println(); }
+  void println();
+
+  long baud;               // Last rate passed to begin()
+  unsigned long sent;      // Bytes written with write()
+  unsigned long blocked;   // Writes that waited for room in the TX buffer
+  uint64_t blocked_us;     // Time they waited
+};
+
+extern SimSerial Serial;
+
+void setup();
+void loop();
+
+#endif
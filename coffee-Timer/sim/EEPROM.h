@@ -0,0 +1,38 @@
+// EEPROM library of the Arduino core on the simulated 1 KB EEPROM. Writes are
+// counted per cell and take EEPROM_WRITE_US each, see avr.cpp.
+
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <Arduino.h>
+
+class EEPROMClass {
+ public:
+  uint8_t read(int idx);
+  void write(int idx, uint8_t val);
+  void update(int idx, uint8_t val);  // Writes only if the cell holds another value
+  uint16_t length() { return 1024; }
+
+  template <typename T>
+  T &get(int idx, T &t) {
+    uint8_t *p = (uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      p[i] = read(idx + i);
+    }
+    return t;
+  }
+
+  // Like the AVR version, put() updates byte by byte
+  template <typename T>
+  const T &put(int idx, const T &t) {
+    const uint8_t *p = (const uint8_t *)&t;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      update(idx + i, p[i]);
+    }
+    return t;
+  }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,260 @@
+// The parts of the ATmega328P the firmware uses: pins, pin change interrupts,
+// Timer1 and Timer2 in CTC mode, the EEPROM, and the two 74HC595s of the
+// display on PORTD.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "sim.h"
+
+SimPortD PORTD;
+volatile uint8_t PORTB, DDRB, DDRD, PINB, PIND;
+volatile uint8_t SREG, SMCR, MCUCR, ADCSRA;
+volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, TIMSK2;
+SimFlags PCIFR, TIFR1, TIFR2;
+
+EEPROMClass EEPROM;
+unsigned long sim_eeprom_writes[1024];
+unsigned long sim_latches;
+
+extern "C" void PCINT2_vect() __attribute__((weak));
+extern "C" void TIMER1_COMPA_vect() __attribute__((weak));
+extern "C" void TIMER2_COMPA_vect() __attribute__((weak));
+
+// Pins
+// ####
+
+// Pins are inputs with pullups after reset, so the encoder and the switch read HIGH at rest
+static struct PinInit {
+  PinInit() {
+    PIND = bit(PIN_A) | bit(PIN_B) | bit(PIN_SWITCH);
+  }
+} pin_init;
+
+static bool relay_on;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  volatile uint8_t &ddr = pin < 8 ? DDRD : DDRB;
+  uint8_t mask = digitalPinToBitMask(pin);
+  if (mode == OUTPUT) {
+    ddr |= mask;
+  } else {
+    ddr &= ~mask;
+  }
+  if (pin == PIN_RELAY) {
+    digitalWrite(pin, PORTB & mask ? HIGH : LOW);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return (pin < 8 ? PIND : PINB) & digitalPinToBitMask(pin) ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  uint8_t mask = digitalPinToBitMask(pin);
+  if (pin < 8) {
+    PORTD = level ? PORTD | mask : PORTD & ~mask;
+    return;
+  }
+  PORTB = level ? PORTB | mask : PORTB & ~mask;
+  if (pin == PIN_RELAY) {
+    bool on = (DDRB & mask) && !level;  // An input leaves the relay module off
+    if (on != relay_on) {
+      relay_on = on;
+      sim_relay(on);
+    }
+  }
+}
+
+// A change on a pin enabled in PCMSK2 flags the PCINT2 interrupt
+void avr_pin_input(int pin, bool level) {
+  uint8_t mask = digitalPinToBitMask(pin);
+  volatile uint8_t &port = pin < 8 ? PIND : PINB;
+  if (!(port & mask) == !level) {
+    return;
+  }
+  port = level ? port | mask : port & ~mask;
+  if (pin < 8 && (PCMSK2 & mask)) {
+    PCIFR.flags |= bit(PCIF2);
+  }
+}
+
+// 74HC595s
+// ########
+
+// Data in on DIO (PD3), shifted on the rising edge of CLK (PD2), copied to the
+// outputs on the rising edge of LOAD (PD4). The first register feeds the second,
+// so after 16 clocks the first byte sent is in the second register.
+static uint16_t shift_reg;
+static uint16_t latched;
+
+SimPortD &SimPortD::operator=(uint8_t v) {
+  uint8_t rising = v & ~val;
+  val = v;
+  sim_cycles(PORT_WRITE_CYCLES);
+  if (rising & bit(2)) {
+    shift_reg = shift_reg << 1 | (v & bit(3) ? 1 : 0);
+  }
+  if (rising & bit(4)) {
+    sim_latches++;
+    if (shift_reg != latched) {
+      latched = shift_reg;
+      sim_display(latched);
+    }
+  }
+  return *this;
+}
+
+// Timers
+// ######
+
+// Timer ticks in microseconds of CPU clock, sim_clock_us
+static bool t1_on, t2_on;
+static uint64_t t1_due, t2_due;
+
+static uint64_t cycles_us(unsigned long cycles) {
+  return cycles / (F_CPU / 1000000);
+}
+
+static unsigned long t1_prescale() {
+  static const unsigned long div[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  return div[TCCR1B & 7];
+}
+
+static unsigned long t2_prescale() {
+  static const unsigned long div[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+  return div[TCCR2B & 7];
+}
+
+// A timer counts from TCNT when its clock is selected. Only CTC mode on
+// compare A is modelled, and changes of OCR while running are not noticed.
+void avr_timers_check() {
+  bool on = t1_prescale() != 0;
+  if (on && !t1_on) {
+    t1_due = sim_clock_us + cycles_us((OCR1A + 1UL - TCNT1) * t1_prescale());
+  }
+  t1_on = on;
+  on = t2_prescale() != 0;
+  if (on && !t2_on) {
+    t2_due = sim_clock_us + cycles_us((OCR2A + 1UL - TCNT2) * t2_prescale());
+  }
+  t2_on = on;
+}
+
+uint64_t avr_timer_due() {
+  uint64_t due = UINT64_MAX;
+  if (t1_on) {
+    due = t1_due;
+  }
+  if (t2_on && t2_due < due) {
+    due = t2_due;
+  }
+  return due;
+}
+
+void avr_timers_run() {
+  while (t1_on && t1_due <= sim_clock_us) {
+    TIFR1.flags |= bit(OCF1A);
+    t1_due += cycles_us((OCR1A + 1UL) * t1_prescale());
+  }
+  while (t2_on && t2_due <= sim_clock_us) {
+    TIFR2.flags |= bit(OCF2A);
+    t2_due += cycles_us((OCR2A + 1UL) * t2_prescale());
+  }
+}
+
+// Interrupts
+// ##########
+
+// Highest priority first, as in the vector table: PCINT2, TIMER2_COMPA,
+// TIMER1_COMPA. An interrupt runs with interrupts disabled and clears its flag.
+// Only the pin change interrupt wakes the CPU from power-down, after WAKE_US.
+void avr_irq_poll() {
+  for (;;) {
+    bool pc = (PCIFR.flags & bit(PCIF2)) && (PCICR & bit(PCIE2));
+    bool t2 = (TIFR2.flags & bit(OCF2A)) && (TIMSK2 & bit(OCIE2A));
+    bool t1 = (TIFR1.flags & bit(OCF1A)) && (TIMSK1 & bit(OCIE1A));
+    if (sim_sleeping) {
+      if (!pc) {
+        return;
+      }
+      if (!sim_wake_at) {
+        sim_wake_at = sim_us + WAKE_US;
+      }
+      if (sim_us < sim_wake_at) {
+        return;
+      }
+      sim_sleeping = false;
+      sim_wake_at = 0;
+    }
+    if (!(pc || t2 || t1) || !(SREG & bit(SREG_I))) {
+      return;
+    }
+    SREG &= ~bit(SREG_I);
+    if (pc) {
+      PCIFR.flags &= ~bit(PCIF2);
+      int steps = encoderSteps;
+      if (PCINT2_vect) {
+        PCINT2_vect();
+      }
+      if (encoderSteps != steps) {
+        sim_detent(encoderSteps > steps ? 1 : -1);
+      }
+    } else if (t2) {
+      TIFR2.flags &= ~bit(OCF2A);
+      if (TIMER2_COMPA_vect) {
+        TIMER2_COMPA_vect();
+      }
+    } else {
+      TIFR1.flags &= ~bit(OCF1A);
+      if (TIMER1_COMPA_vect) {
+        TIMER1_COMPA_vect();
+      }
+    }
+    sim_advance(ISR_US);
+    SREG |= bit(SREG_I);
+  }
+}
+
+// EEPROM
+// ######
+
+static uint8_t eeprom[1024];
+static uint64_t eeprom_busy_until;  // End of the write in progress
+
+static struct EepromInit {
+  EepromInit() {
+    memset(eeprom, 0xFF, sizeof(eeprom));  // Erased
+  }
+} eeprom_init;
+
+void avr_eeprom_poke(int addr, uint8_t val) {
+  eeprom[addr & 1023] = val;
+}
+
+// Reads and writes wait for a write in progress
+static void eeprom_wait() {
+  if (sim_us < eeprom_busy_until) {
+    sim_advance(eeprom_busy_until - sim_us);
+  }
+}
+
+uint8_t EEPROMClass::read(int idx) {
+  eeprom_wait();
+  return eeprom[idx & 1023];
+}
+
+void EEPROMClass::write(int idx, uint8_t val) {
+  eeprom_wait();
+  eeprom[idx & 1023] = val;
+  sim_eeprom_writes[idx & 1023]++;
+  eeprom_busy_until = sim_us + EEPROM_WRITE_US;
+}
+
+void EEPROMClass::update(int idx, uint8_t val) {
+  if (read(idx) != val) {
+    write(idx, val);
+  }
+}
@@ -0,0 +1,19 @@
+// Sleep modes of avr-libc. sleep_cpu() returns once an interrupt has woken the
+// simulated CPU, see sim_main.cpp.
+
+#ifndef AVR_SLEEP_H
+#define AVR_SLEEP_H
+
+#include <Arduino.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN bit(SM1)
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & bit(SE)) | (mode))
+#define sleep_enable() (SMCR |= bit(SE))
+#define sleep_disable() (SMCR &= ~bit(SE))
+#define sleep_bod_disable() ((void)0)
+
+void sleep_cpu();
+
+#endif
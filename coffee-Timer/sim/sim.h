@@ -0,0 +1,59 @@
+// Host-native simulator for the coffee timer: simulated time, the parts of the
+// ATmega328P the firmware uses and the hardware on its pins: rotary encoder,
+// switch, relay and the two 74HC595s of the display.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+// Pin numbers as in src/main.cpp
+const int PIN_A = 5;
+const int PIN_B = 6;
+const int PIN_SWITCH = 7;
+const int PIN_RELAY = 8;
+
+// Simulated time
+// ##############
+
+extern uint64_t sim_us;        // Microseconds since power on
+extern uint64_t sim_clock_us;  // Time the CPU clock ran, stops in power-down sleep
+extern bool sim_sleeping;      // In power-down, set by sleep_cpu()
+extern uint64_t sim_wake_at;   // sim_us the CPU runs again after a wake-up, 0 if none
+void sim_advance(uint64_t us);
+void sim_cycles(unsigned int n);  // CPU time in clock cycles, for code shorter than 1 us
+
+// Start-up time after a wake-up from power-down, 16K CK with the fuses of the Uno
+const uint64_t WAKE_US = 1000;
+// EEPROM write, the AVR waits for the previous one before it starts the next
+const uint64_t EEPROM_WRITE_US = 3400;
+// Entry, body and exit of an interrupt routine without calls
+const uint64_t ISR_US = 4;
+// A PORTD write in the display loop, with its share of the loop around it
+const unsigned int PORT_WRITE_CYCLES = 4;
+
+// ATmega328P (avr.cpp)
+// ####################
+
+void avr_pin_input(int pin, bool level);  // Level driven onto an input pin
+void avr_timers_check();        // Notice timers started or stopped by the firmware
+uint64_t avr_timer_due();       // sim_clock_us of the next compare match, UINT64_MAX if none
+void avr_timers_run();          // Flag the compare matches due by sim_clock_us
+void avr_irq_poll();            // Take pending interrupts if enabled, wake from sleep
+void avr_eeprom_poke(int addr, uint8_t val);   // EEPROM content before power on
+
+extern unsigned long sim_eeprom_writes[1024];  // Writes per EEPROM cell
+extern unsigned long sim_latches;              // Frames latched into the 74HC595s
+
+// Simulator (sim_main.cpp), called back by avr.cpp
+// ################################################
+
+void sim_relay(bool on);              // Relay input changed, active-low
+void sim_detent(int dir);             // The decoder counted a detent, +1 clockwise
+void sim_display(uint16_t latched);   // New 74HC595 outputs, digit 1 in the low byte
+
+// Firmware state the report looks at
+extern volatile int encoderSteps;
+extern volatile unsigned int tenthsLeft;
+
+#endif
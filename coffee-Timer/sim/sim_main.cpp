@@ -0,0 +1,642 @@
+// Runs the firmware against the simulated ATmega328P. Implements the Arduino
+// time and Serial functions and sleep_cpu(), replays a script of knob turns and
+// switch presses as edges on the encoder and switch pins, and reports how the
+// firmware took them.
+//
+// usage: coffee_timer_sim [--seed N] [--quiet] [script]
+//
+// Script lines are "<ms> <event> [args]", '#' starts a comment:
+//   turn N [MS] [BOUNCE]   N detents, negative counter-clockwise, MS ms each (default 150),
+//                          every edge bouncing for up to BOUNCE us (default 0)
+//   press [MS] [BOUNCE]    hold the switch down for MS ms (default 300)
+//   wave FILE [N]          replay recorded A/B levels, N detents expected (default 0)
+//   eeprom ADDR VALUE      EEPROM byte at power on, at 0 ms only
+//   end                    stop the simulation
+//
+// A wave file has a line "<us> <A><B>" per change, e.g. "1250 01", with the time
+// from the start of the event. Both pins are HIGH before the first line.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include "sim.h"
+
+const uint64_t LOOP_US = 20;     // CPU time of one pass through loop() apart from what is modelled
+const uint64_t CLOCK_US = 4;     // Reading the clock
+const uint64_t PRINT_US = 4;     // Serial.write() of one byte into the TX buffer
+const unsigned long TURN_MS = 150;
+const unsigned long PRESS_MS = 300;
+
+uint64_t sim_us;
+uint64_t sim_clock_us;
+bool sim_sleeping;
+uint64_t sim_wake_at;
+SimSerial Serial;
+
+static bool quiet;
+static bool line_start = true;
+static uint32_t seed = 1;
+static uint64_t end_us;
+
+// Input edges
+// ###########
+
+struct Edge {
+  uint64_t us;
+  uint8_t pin;
+  uint8_t level;
+  int order;  // Edges at the same time stay in the order they were added
+};
+
+static Edge *edges;
+static int n_edges, max_edges;
+static int next_edge;
+
+static void add_edge(uint64_t us, int pin, bool level) {
+  if (n_edges == max_edges) {
+    max_edges = max_edges ? 2 * max_edges : 1024;
+    edges = (Edge *)realloc(edges, max_edges * sizeof(Edge));
+  }
+  Edge &e = edges[n_edges];
+  e.us = us;
+  e.pin = pin;
+  e.level = level;
+  e.order = n_edges++;
+}
+
+static int edge_cmp(const void *a, const void *b) {
+  const Edge *x = (const Edge *)a, *y = (const Edge *)b;
+  if (x->us != y->us) {
+    return x->us < y->us ? -1 : 1;
+  }
+  return x->order - y->order;
+}
+
+static uint32_t rnd() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// A contact bounces: after the edge to 'level' at 'us' it opens and closes again
+// one to three times within 'bounce' us, but at most until 'room' us later.
+static void add_transition(uint64_t us, int pin, bool level, unsigned long bounce, uint64_t room) {
+  add_edge(us, pin, level);
+  if (bounce >= room) {
+    bounce = room > 1 ? room - 1 : 0;
+  }
+  if (bounce < 2) {
+    return;
+  }
+  int n = 2 * (1 + rnd() % 3);
+  unsigned long t[6];
+  for (int i = 0; i < n; i++) {
+    t[i] = 1 + rnd() % (bounce - 1);
+  }
+  for (int i = 1; i < n; i++) {  // Sort, each toggle at least 1 us after the last
+    for (int j = i; j > 0 && t[j] < t[j - 1]; j--) {
+      unsigned long x = t[j];
+      t[j] = t[j - 1];
+      t[j - 1] = x;
+    }
+  }
+  unsigned long last = 0;
+  for (int i = 0; i < n; i++) {
+    last = t[i] > last ? t[i] : last + 1;
+    add_edge(us + last, pin, i % 2 ? level : !level);
+  }
+}
+
+// One detent is four transitions, A and B in turn, a quarter of the detent apart.
+// Clockwise A leads: AB 11, 01, 00, 10, 11.
+static void add_turn(uint64_t us, int detents, unsigned long ms, unsigned long bounce) {
+  uint64_t quarter = ms * 1000 / 4;
+  int lead = detents > 0 ? PIN_A : PIN_B;
+  int lag = detents > 0 ? PIN_B : PIN_A;
+  for (int i = 0; i < abs(detents); i++) {
+    uint64_t t = us + i * ms * 1000 + quarter / 2;
+    add_transition(t, lead, LOW, bounce, 2 * quarter);
+    add_transition(t + quarter, lag, LOW, bounce, 2 * quarter);
+    add_transition(t + 2 * quarter, lead, HIGH, bounce, 2 * quarter);
+    add_transition(t + 3 * quarter, lag, HIGH, bounce, 2 * quarter);
+  }
+}
+
+static void add_press(uint64_t us, unsigned long ms, unsigned long bounce) {
+  add_transition(us, PIN_SWITCH, LOW, bounce, ms * 1000);
+  add_transition(us + ms * 1000, PIN_SWITCH, HIGH, bounce, ms * 1000);
+}
+
+static bool add_wave(uint64_t us, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  char line[80];
+  bool a = HIGH, b = HIGH;
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long t;
+    char ab[3];
+    if (line[0] == '#' || sscanf(line, "%lu %2s", &t, ab) < 2) {
+      continue;
+    }
+    if ((ab[0] == '1') != a) {
+      a = !a;
+      add_edge(us + t, PIN_A, a);
+    }
+    if ((ab[1] == '1') != b) {
+      b = !b;
+      add_edge(us + t, PIN_B, b);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// Simulated time
+// ##############
+
+// Time passes up to 't': input edges are applied and timer compare matches
+// flagged in order, and pending interrupts taken in between. In power-down
+// sleep the CPU clock and with it the timers stand still.
+static void run_until(uint64_t t) {
+  for (;;) {
+    while (next_edge < n_edges && edges[next_edge].us <= sim_us) {
+      avr_pin_input(edges[next_edge].pin, edges[next_edge].level);
+      next_edge++;
+    }
+    avr_timers_run();
+    avr_irq_poll();
+    avr_timers_check();
+    if (sim_us >= t) {
+      return;
+    }
+    uint64_t next = t;
+    if (next_edge < n_edges && edges[next_edge].us < next) {
+      next = edges[next_edge].us;
+    }
+    if (sim_wake_at && sim_wake_at < next) {
+      next = sim_wake_at;
+    }
+    uint64_t due = avr_timer_due();
+    if (!sim_sleeping && due != UINT64_MAX && sim_us + (due - sim_clock_us) < next) {
+      next = sim_us + (due - sim_clock_us);
+    }
+    if (!sim_sleeping) {
+      sim_clock_us += next - sim_us;
+    }
+    sim_us = next;
+  }
+}
+
+void sim_advance(uint64_t us) {
+  run_until(sim_us + us);
+}
+
+void sim_cycles(unsigned int n) {
+  static unsigned int cycles;
+  cycles += n;
+  if (cycles >= F_CPU / 1000000) {
+    sim_advance(cycles / (F_CPU / 1000000));
+    cycles %= F_CPU / 1000000;
+  }
+}
+
+unsigned long millis() {
+  sim_advance(CLOCK_US);
+  return sim_clock_us / 1000;
+}
+
+unsigned long micros() {
+  sim_advance(CLOCK_US);
+  return sim_clock_us;
+}
+
+void delay(unsigned long ms) {
+  sim_advance(ms * 1000ULL);
+}
+
+char *itoa(int value, char *buf, int base) {
+  char digits[18];
+  int i = 0;
+  unsigned int n = value < 0 && base == 10 ? -(unsigned int)value : (unsigned int)value;
+  do {
+    int d = n % base;
+    digits[i++] = d < 10 ? '0' + d : 'a' + d - 10;
+    n /= base;
+  } while (n);
+  char *p = buf;
+  if (value < 0 && base == 10) {
+    *p++ = '-';
+  }
+  while (i) {
+    *p++ = digits[--i];
+  }
+  *p = 0;
+  return buf;
+}
+
+static void report();
+
+// Sleeps until a pin change interrupt has woken the CPU. With no input left
+// before the end of the script, the simulation ends here.
+static unsigned long sleeps;
+static uint64_t asleep_us;
+
+void sleep_cpu() {
+  if (!(SMCR & bit(SE))) {
+    return;
+  }
+  uint64_t from = sim_us;
+  sim_sleeping = true;
+  sleeps++;
+  while (sim_sleeping) {
+    uint64_t t = sim_wake_at ? sim_wake_at : next_edge < n_edges ? edges[next_edge].us : end_us;
+    if (!sim_wake_at && t >= end_us) {
+      sim_us = end_us;
+      asleep_us += sim_us - from;
+      report();
+      exit(0);
+    }
+    run_until(t > sim_us ? t : sim_us + 1);
+  }
+  asleep_us += sim_us - from;
+}
+
+// Serial
+// ######
+
+// HardwareSerial holds 63 bytes in its ring buffer, one in UDR and one in the
+// shift register. Beyond that write() waits for the UART.
+static const int TX_ROOM = 65;
+static uint64_t tx_done;  // sim_us the last byte written is out
+
+static uint64_t byte_us() {
+  return Serial.baud ? 10000000 / Serial.baud : 0;
+}
+
+void SimSerial::begin(long b) {
+  baud = b;
+}
+
+int SimSerial::availableForWrite() {
+  sim_advance(CLOCK_US);  // Reading the buffer indices, keeps wait loops moving
+  if (!baud || tx_done <= sim_us) {
+    return 63;
+  }
+  long queued = (long)((tx_done - sim_us + byte_us() - 1) / byte_us()) - 2;
+  return queued <= 0 ? 63 : queued >= 63 ? 0 : 63 - queued;
+}
+
+void SimSerial::flush() {
+  if (tx_done > sim_us) {
+    sim_advance(tx_done - sim_us);
+  }
+}
+
+// Text goes to stdout with a timestamp per line.
+size_t SimSerial::write(uint8_t b) {
+  sent++;
+  sim_advance(PRINT_US);
+  if (baud) {
+    uint64_t limit = sim_us + TX_ROOM * byte_us();
+    if (tx_done > limit) {
+      blocked++;
+      blocked_us += tx_done - limit;
+      sim_advance(tx_done - limit);
+    }
+    tx_done = (tx_done > sim_us ? tx_done : sim_us) + byte_us();
+  }
+  if (quiet) {
+    return 1;
+  }
+  if (line_start) {
+    printf("%9.3f  ", sim_us / 1e6);
+    line_start = false;
+  }
+  if (b == '\r') {
+    return 1;
+  }
+  putchar(b);
+  if (b == '\n') {
+    line_start = true;
+  }
+  return 1;
+}
+
+size_t SimSerial::write(const uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    write(buf[i]);
+  }
+  return len;
+}
+
+void SimSerial::print(const char *s) {
+  write((const uint8_t *)s, strlen(s));
+}
+
+void SimSerial::print(char c) {
+  write((uint8_t)c);
+}
+
+void SimSerial::print(long n, int base) {
+  if (n < 0) {
+    write('-');
+    n = -n;
+  }
+  print((unsigned long)n, base);
+}
+
+void SimSerial::print(unsigned long n, int base) {
+  char buf[34];
+  int i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    int d = n % base;
+    buf[--i] = d < 10 ? '0' + d : 'A' + d - 10;
+    n /= base;
+  } while (n);
+  print(buf + i);
+}
+
+void SimSerial::println() {
+  print("\r\n");
+}
+
+// Hardware on the pins
+// ####################
+
+// Knob events and the detents the decoder counted while each was the latest one
+struct Knob {
+  uint64_t us;
+  int expected;
+  int cw, ccw;
+  char what[48];
+};
+
+static Knob knobs[64];
+static int n_knobs;
+static int stray_cw, stray_ccw;  // Detents before the first knob event
+
+void sim_detent(int dir) {
+  int i = n_knobs - 1;
+  while (i >= 0 && knobs[i].us > sim_us) {
+    i--;
+  }
+  if (i < 0) {
+    (dir > 0 ? stray_cw : stray_ccw)++;
+  } else {
+    (dir > 0 ? knobs[i].cw : knobs[i].ccw)++;
+  }
+}
+
+// Each time the relay closes, with the countdown set at that moment
+struct Shot {
+  uint64_t on_us, off_us;
+  unsigned int tenths;  // 0 if not closed by a countdown
+  bool finished;        // Opened by the countdown running out, not by a press
+};
+
+static Shot shots[64];
+static int n_shots;
+static bool relay_closed;
+
+void sim_relay(bool on) {
+  relay_closed = on;
+  if (on && n_shots < 64) {
+    Shot &s = shots[n_shots++];
+    s.on_us = sim_us;
+    s.off_us = 0;
+    s.tenths = tenthsLeft;
+    s.finished = false;
+  } else if (!on && n_shots > 0) {
+    Shot &s = shots[n_shots - 1];
+    s.off_us = sim_us;
+    s.finished = s.tenths > 0 && tenthsLeft == 0;
+  }
+  if (!quiet) {
+    printf("%s%9.3f  [relay %s]\n", line_start ? "" : "\n", sim_us / 1e6, on ? "on" : "off");
+    line_start = true;
+  }
+}
+
+// Segment patterns of the digits as wired, LOW lights a segment, bit 7 is the
+// decimal point.
+static const uint8_t digit_segments[10] = {
+  0xC0, 0xF9, 0xA4, 0xB0, 0x99, 0x92, 0x83, 0xF8, 0x80, 0x98
+};
+
+static void digit_text(uint8_t seg, char *out) {
+  out[0] = seg == 0xFF ? ' ' : '?';
+  for (int i = 0; i < 10; i++) {
+    if ((seg | 0x80) == digit_segments[i]) {
+      out[0] = '0' + i;
+    }
+  }
+  out[1] = seg & 0x80 ? 0 : '.';
+  out[2] = 0;
+}
+
+void sim_display(uint16_t latched) {
+  if (quiet) {
+    return;
+  }
+  char d1[3], d2[3];
+  digit_text(latched & 0xFF, d1);
+  digit_text(latched >> 8, d2);
+  printf("%s%9.3f  [display %s%s]\n", line_start ? "" : "\n", sim_us / 1e6, d1, d2);
+  line_start = true;
+}
+
+// Script
+// ######
+
+static const char default_script[] =
+  "# Set 25 s slowly and brew. Then turns at rising speed with bouncy contacts,\n"
+  "# a shot stopped early, and a wake-up from sleep by the knob.\n"
+  "500 turn 25 150\n"
+  "10000 press 300 2000\n"
+  "37000 turn -10 60 500\n"
+  "39000 turn 10 30 500\n"
+  "41000 turn -10 15 500\n"
+  "43000 turn 10 8 300\n"
+  "45000 turn -10 4 200\n"
+  "47000 turn 8 150\n"
+  "52000 press 300 2000\n"
+  "55000 press 300 2000\n"
+  "130000 turn 3 100 500\n"
+  "135000 end\n";
+
+static char *read_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *text = (char *)malloc(len + 1);
+  text[fread(text, 1, len, f)] = 0;
+  fclose(f);
+  return text;
+}
+
+static void parse_script(const char *text) {
+  uint64_t last_us = 0;
+  while (*text) {
+    const char *eol = strchr(text, '\n');
+    size_t len = eol ? (size_t)(eol - text) : strlen(text);
+    char line[160];
+    snprintf(line, sizeof(line), "%.*s", (int)len, text);
+    text += len + (eol ? 1 : 0);
+    unsigned long ms;
+    char what[16], arg[3][64] = { "", "", "" };
+    if (line[0] == '#' || sscanf(line, "%lu %15s %63s %63s %63s", &ms, what, arg[0], arg[1], arg[2]) < 2) {
+      continue;
+    }
+    uint64_t us = ms * 1000ULL;
+    last_us = us > last_us ? us : last_us;
+    bool knob = false;
+    int expected = 0;
+    if (!strcmp(what, "turn")) {
+      expected = atoi(arg[0]);
+      unsigned long per = arg[1][0] ? atol(arg[1]) : TURN_MS;
+      unsigned long bounce = atol(arg[2]);
+      add_turn(us, expected, per, bounce);
+      last_us = us + abs(expected) * per * 1000ULL;
+      knob = true;
+      snprintf(arg[1], sizeof(arg[1]), "%lu", per);
+      snprintf(arg[2], sizeof(arg[2]), "%lu", bounce);
+    } else if (!strcmp(what, "press")) {
+      unsigned long hold = arg[0][0] ? atol(arg[0]) : PRESS_MS;
+      add_press(us, hold, atol(arg[1]));
+      last_us = us + hold * 1000ULL;
+    } else if (!strcmp(what, "wave")) {
+      knob = add_wave(us, arg[0]);
+      expected = atoi(arg[1]);
+    } else if (!strcmp(what, "eeprom")) {
+      avr_eeprom_poke(atoi(arg[0]), atoi(arg[1]));
+    } else if (!strcmp(what, "end")) {
+      end_us = us;
+    } else {
+      fprintf(stderr, "sim: unknown event %s\n", what);
+    }
+    if (knob && n_knobs < 64) {
+      Knob &k = knobs[n_knobs++];
+      k.us = us;
+      k.expected = expected;
+      k.cw = k.ccw = 0;
+      if (!strcmp(what, "turn")) {
+        snprintf(k.what, sizeof(k.what), "turn %d, %.8s ms, bounce %.8s us", expected, arg[1], arg[2]);
+      } else {
+        snprintf(k.what, sizeof(k.what), "wave %.30s", arg[0]);
+      }
+    }
+  }
+  if (!end_us) {
+    end_us = last_us + 1000000;
+  }
+  qsort(edges, n_edges, sizeof(Edge), edge_cmp);
+}
+
+// Report
+// ######
+
+// A detent against the expected direction is spurious, and so is one too many
+// in it. One too few is missed.
+static void knob_report() {
+  int turned = 0, counted = stray_cw + stray_ccw, missed = 0, spurious = stray_cw + stray_ccw;
+  for (int i = 0; i < n_knobs; i++) {
+    const Knob &k = knobs[i];
+    int want = abs(k.expected);
+    int with = k.expected >= 0 ? k.cw : k.ccw;
+    int against = k.expected >= 0 ? k.ccw : k.cw;
+    int m = want > with ? want - with : 0;
+    int s = against + (with > want ? with - want : 0);
+    printf("knob at %.3f s, %s: %d cw %d ccw counted, %d missed, %d spurious\n", k.us / 1e6,
+           k.what, k.cw, k.ccw, m, s);
+    turned += want;
+    counted += k.cw + k.ccw;
+    missed += m;
+    spurious += s;
+  }
+  printf("encoder: %d detents turned, %d counted, %d missed, %d spurious\n", turned, counted,
+         missed, spurious);
+}
+
+// On-time error is against the setpoint when the countdown started
+static void relay_report() {
+  double worst = 0;
+  int timed = 0;
+  for (int i = 0; i < n_shots; i++) {
+    const Shot &s = shots[i];
+    uint64_t off = i == n_shots - 1 && relay_closed ? sim_us : s.off_us;
+    double on_ms = (off - s.on_us) / 1e3;
+    if (!s.tenths) {
+      printf("relay at %.3f s: closed for %.3f ms outside a countdown\n", s.on_us / 1e6, on_ms);
+    } else if (!s.finished) {
+      printf("relay at %.3f s: set %.1f s, stopped after %.3f ms\n", s.on_us / 1e6, s.tenths / 10.0,
+             on_ms);
+    } else {
+      double err = on_ms - s.tenths * 100.0;
+      printf("relay at %.3f s: set %.1f s, on %.3f ms, error %+.3f ms\n", s.on_us / 1e6,
+             s.tenths / 10.0, on_ms, err);
+      worst = err < 0 ? (-err > worst ? -err : worst) : (err > worst ? err : worst);
+      timed++;
+    }
+  }
+  printf("relay: %d countdowns run out, largest on-time error %.3f ms\n", timed, worst);
+}
+
+static void eeprom_report() {
+  unsigned long total = 0, most = 0;
+  int cells = 0;
+  for (int i = 0; i < 1024; i++) {
+    total += sim_eeprom_writes[i];
+    cells += sim_eeprom_writes[i] > 0;
+    most = sim_eeprom_writes[i] > most ? sim_eeprom_writes[i] : most;
+  }
+  printf("EEPROM: %lu byte writes to %d cells, at most %lu to one cell\n", total, cells, most);
+}
+
+static void report() {
+  if (!line_start) {
+    putchar('\n');
+  }
+  printf("\nsim: %.3f s simulated, %.3f s asleep in %lu sleeps\n", sim_us / 1e6, asleep_us / 1e6,
+         sleeps);
+  knob_report();
+  relay_report();
+  eeprom_report();
+  printf("display: %lu frames latched\n", sim_latches);
+  printf("serial: %lu bytes written, %lu writes blocked for %.3f ms in all\n", Serial.sent,
+         Serial.blocked, Serial.blocked_us / 1e3);
+}
+
+int main(int argc, char **argv) {
+  const char *script = default_script;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      seed = strtoul(argv[++i], 0, 0) | 1;
+    } else if (!strcmp(argv[i], "--quiet")) {
+      quiet = true;
+    } else {
+      script = read_file(argv[i]);
+    }
+  }
+  parse_script(script);
+
+  SREG = bit(SREG_I);  // init() of the Arduino core enables interrupts before setup()
+  setup();
+  while (sim_us < end_us) {
+    loop();
+    sim_advance(LOOP_US);
+  }
+  report();
+  return 0;
+}
@@ -0,0 +1,27 @@
+// ATOMIC_BLOCK of avr-libc: interrupts off for the block, the state before is
+// restored however the block is left.
+
+#ifndef UTIL_ATOMIC_H
+#define UTIL_ATOMIC_H
+
+#include <Arduino.h>
+
+static inline uint8_t sim_atomic_enter() {
+  uint8_t sreg = SREG;
+  cli();
+  return sreg;
+}
+
+static inline void sim_atomic_restore(const uint8_t *sreg) {
+  SREG = *sreg;
+}
+
+static inline void sim_atomic_on(const uint8_t *) {
+  sei();
+}
+
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(sim_atomic_restore))) = sim_atomic_enter()
+#define ATOMIC_FORCEON uint8_t sreg_save __attribute__((__cleanup__(sim_atomic_on))) = sim_atomic_enter()
+#define ATOMIC_BLOCK(type) for (type, atomic_once = 1; atomic_once; atomic_once = 0)
+
+#endif
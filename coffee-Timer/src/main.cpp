@@ -1,14 +1,78 @@
 #include <Arduino.h>
-#include <ShiftRegister74HC595.h>
 #include <EEPROM.h> // Include the EEPROM library
+#include <util/atomic.h> // ATOMIC_BLOCK for data shared with interrupts
+#include <avr/sleep.h> // Power-down sleep when idle
 
-// Pin definitions for the shift registers
+// Serial log. Messages are queued as a pointer to their text in flash and an
+// optional number, and written out by logDrain() from loop() only as far as the
+// TX buffer has room, so a message never makes loop() wait for the UART. When
+// the queue is full, messages are dropped and their number is logged later.
+// Levels above LOG_LEVEL are not compiled in: build with -D LOG_LEVEL=LOG_LEVEL_NONE
+// for no Serial at all, or LOG_LEVEL_INFO to leave out the messages of each
+// step and countdown tick.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_INFO 1  // Switch presses, countdowns, saves, sleep
+#define LOG_LEVEL_DEBUG 2 // Each encoder step and countdown second
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(text, ...) logPut(PSTR(text), ##__VA_ARGS__)
+#else
+#define LOG_INFO(text, ...) ((void)0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(text, ...) logPut(PSTR(text), ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(text, ...) ((void)0)
+#endif
+
+struct LogRecord {
+  const char *text; // In flash
+  int value;
+  bool hasValue;
+};
+const uint8_t logSize = 16; // Queued messages, 5 bytes of RAM each
+
+// Only loop() and the functions it calls log, so the queue needs no locking
+LogRecord logRing[logSize];
+uint8_t logHead = 0;      // Oldest message, the one being written out
+uint8_t logCount = 0;     // Messages queued
+uint8_t logPos = 0;       // Next character of its text
+int8_t logTailPos = -1;   // Next character of logTail, -1 while the text is not done
+char logTail[9];          // Number and line end of the message being written out
+unsigned int logDropped = 0; // Messages dropped since the last one queued
+
+void logBegin();
+void logQueue(const char *text, int value, bool hasValue);
+void logPut(const char *text);
+void logPut(const char *text, int value);
+void logDrain();
+void logFlush();
+
+// Pin definitions for the shift registers (2 shift registers in series)
 #define DIO 3         // Data pin (SDI)
 #define CLK 2         // Clock pin (SCLK)
 #define LOAD 4        // Latch pin (LOAD)
 
-// Initialize shift register (2 shift registers in series)
-ShiftRegister74HC595<2> sr(DIO, CLK, LOAD);
+// Display driver. DIO, CLK and LOAD are PD3, PD2 and PD4 on the Uno, not the SPI
+// pins, so the bits are clocked out by writing PORTD directly (single sbi/cbi
+// instructions, a few microseconds for both digits). A frame equal to the one
+// latched last is not sent again.
+const uint8_t dioMask = bit(DIO);
+const uint8_t clkMask = bit(CLK);
+const uint8_t loadMask = bit(LOAD);
+const uint8_t blankDigit = B11111111; // All segments off
+const bool blankLeadingZero = false;  // Show 5 instead of 05
+const uint8_t brightnessMax = 8;      // Brightness levels per digit, 8 = always on
+
+// Below brightnessMax, Timer2 latches the frame and a blank one in turn, in
+// brightnessMax slots of 0.5 ms. A digit is lit in the first 'brightness' slots.
+uint8_t displayFrame[2] = {blankDigit, blankDigit}; // Segment patterns to show
+uint8_t displayBrightness[2] = {brightnessMax, brightnessMax};
+uint8_t latchedFrame[2] = {0, 0}; // What the shift registers hold, 0 before the first send
+volatile uint8_t brightnessSlot = 0;
 
 // Pin definitions for the rotary encoder
 #define ENCODER_PIN_A 5 // Encoder output A
@@ -20,14 +84,38 @@ ShiftRegister74HC595<2> sr(DIO, CLK, LOAD);
 
 // Variables for the encoder and countdown
 int currentCount = 0; // Stores the current countdown value (0-45)
-bool counting = false; // Indicates if the countdown is active
-unsigned long previousMillis = 0; // Stores the last time the countdown was updated
-const int interval = 1000; // Countdown interval (1 second in milliseconds)
+volatile bool counting = false; // Indicates if the countdown is active, cleared by the timer at expiry
 const int maxCount = 45; // Maximum countdown value (45 seconds)
 
-// EEPROM address to store the last set timer value
+// Countdown engine: Timer1 interrupts every tenth of a second, counted from the
+// switch press by the hardware, so a late loop() cannot add drift. The interrupt
+// turns the relay off on the tick the countdown runs out.
+const uint16_t tickCompare = F_CPU / 256 / 10 - 1; // Timer1 compare value, prescaler 256, 100 ms
+const bool showTenths = true; // Below 10 s show 9.9 to 0.1 instead of whole seconds
+volatile unsigned int tenthsLeft = 0; // Tenths of a second until the relay goes off
+volatile bool countdownDone = false; // Set by the timer interrupt when the countdown ran out
+
+// EEPROM address to store the last set timer value. Earlier versions kept it in
+// this one byte; it is now the start of a ring of setpoint slots.
 const int eepromAddress = 0;
 
+// One saved setpoint. Each save goes to the next slot of the ring with a sequence
+// number one higher, so the cells wear evenly and the newest slot is the one
+// with the highest number. 'check' tells written slots from erased or torn ones.
+struct SetpointSlot {
+  uint16_t seq;
+  uint8_t value;
+  uint8_t check;
+};
+const int setpointSlots = 64;           // 256 bytes, each cell takes 1/64 of the writes
+const unsigned long saveDelay = 5000;   // ms the knob must rest before the setpoint is saved
+
+int setpoint = 0;               // Countdown value last set with the knob, currentCount runs down from it
+bool setpointChanged = false;   // The knob moved since the last save
+uint16_t setpointSeq = 0;       // Sequence number of the newest slot
+int savedCount = -1;            // Setpoint in the newest slot, -1 if none
+unsigned long lastKnobChange = 0; // millis() of the last change by the knob
+
 // 7-Segment display segment definitions (common cathode)
 uint8_t numberB[] = {
     B11000000, // 0
@@ -42,111 +130,429 @@ uint8_t numberB[] = {
     B10011000  // 9
 };
 
-// Function declaration for updateDisplay
+// Function declarations
 void updateDisplay(int number);
+void displayBegin();
+void displayShow(uint8_t digit1, uint8_t digit2);
+void displaySetBrightness(uint8_t digit1, uint8_t digit2);
+void displaySend(uint8_t digit1, uint8_t digit2);
+void sleepUntilInput();
+void updateDisplayTenths(unsigned int tenths);
+void countdownStart(unsigned int tenths);
+void countdownStop();
+unsigned int countdownLeft();
+void encoderBegin();
+int encoderRead();
+int setpointLoad();
+void setpointSave();
+uint8_t setpointCheck(const SetpointSlot &slot);
+
+// Quadrature decoder, fed by the pin change interrupt of ENCODER_PIN_A and ENCODER_PIN_B.
+// Index: previous state << 2 | new state, a state is A << 1 | B. Valid Gray-code
+// transitions count +1 (clockwise) or -1, no change and skipped states count 0.
+// Contact bounce moves back and forth between two states, so it cancels out.
+const int8_t quadTable[16] = {
+    0, -1,  1,  0,
+    1,  0,  0, -1,
+   -1,  0,  0,  1,
+    0,  1, -1,  0
+};
+const uint8_t encoderRest = B11; // A and B both HIGH at a detent
+const int8_t encoderMinSum = 2;   // Transitions needed for one detent, 4 without a miss
+
+// Acceleration: a detent that follows the last one within accelTime ms counts
+// 1 + accelTime / (ms since the last detent), at most accelMax.
+const bool encoderAcceleration = true;
+const unsigned long accelTime = 40;
+const int8_t accelMax = 6;
+
+volatile int encoderSteps = 0;    // Detents counted by the interrupt, taken by encoderRead()
+volatile uint8_t encoderState;    // Last A/B state seen by the interrupt
+volatile int8_t encoderSum = 0;   // Transitions since the last detent
+volatile unsigned long lastDetent = 0; // millis() of the last detent
+volatile uint8_t *encoderPort;    // Input register of both encoder pins
+uint8_t encoderMaskA, encoderMaskB;
 
-// Variables for encoder debouncing
-unsigned long lastEncoderChange = 0; // Timestamp of the last encoder change
+// Idle power mode: after idleTimeout ms without a countdown, knob or switch
+// activity the display is blanked and the ATmega goes to power-down sleep. A pin
+// change on the encoder or the switch wakes it up.
+const unsigned long idleTimeout = 60000;
+unsigned long lastActivity = 0; // millis() of the last countdown, knob or switch activity
+
+// Variables for switch debouncing
+unsigned long lastSwitchChange = 0; // Timestamp of the last switch change
 const int debounceDelay = 50; // Debounce delay in milliseconds
 
 void setup() {
   // Initialize pins
+  digitalWrite(RELAY_PIN, HIGH); // Relay off (active-low), set before the pin drives it
   pinMode(RELAY_PIN, OUTPUT);
-  digitalWrite(RELAY_PIN, HIGH); // Ensure the relay is off at startup (active-low)
+  displayBegin();
 
   pinMode(ENCODER_PIN_A, INPUT_PULLUP); // Encoder pin A with pullup resistor
   pinMode(ENCODER_PIN_B, INPUT_PULLUP); // Encoder pin B with pullup resistor
   pinMode(ENCODER_SWITCH, INPUT_PULLUP); // Encoder switch with pullup resistor
+  encoderBegin(); // Start counting encoder steps in the background
 
   // Initialize Serial Communication for debugging
-  Serial.begin(9600);
-  Serial.println("Timer ready. Waiting for input...");
+  logBegin();
+  LOG_INFO("Timer ready. Waiting for input...");
 
   // Read the last set timer value from EEPROM
-  currentCount = EEPROM.read(eepromAddress);
+  currentCount = setpointLoad();
   if (currentCount > maxCount) {
     currentCount = 0; // Ensure the value is within the valid range
   }
+  setpoint = currentCount;
 
   // Initialize the display to show the last set timer value
   updateDisplay(currentCount);
 }
 
 void loop() {
-  static int lastA = digitalRead(ENCODER_PIN_A); // Store the initial state of ENCODER_PIN_A
   static bool lastSwitchState = HIGH; // Stores the previous state of the encoder switch
 
-  // Handle encoder switch press
+  // Handle encoder switch press, edges within debounceDelay of the last one are ignored
   bool currentSwitchState = digitalRead(ENCODER_SWITCH);
+  if (currentSwitchState != lastSwitchState && millis() - lastSwitchChange < debounceDelay) {
+    currentSwitchState = lastSwitchState;
+  }
+  if (currentSwitchState != lastSwitchState) {
+    lastSwitchChange = millis();
+  }
   if (lastSwitchState == HIGH && currentSwitchState == LOW) {
     // Switch pressed
     if (!counting) {
       // If countdown is not active, check if a countdown value is set
       if (currentCount > 0) {
         // Start the countdown only if the countdown value is greater than 0
-        Serial.println("Encoder switch pressed. Countdown started.");
-        counting = true;
-        digitalWrite(RELAY_PIN, LOW); // Turn on the relay (active-low)
-        previousMillis = millis(); // Reset the countdown timer
+        LOG_INFO("Encoder switch pressed. Countdown started.");
+        countdownStart(currentCount * 10); // Turns on the relay
+        setpointSave(); // Keep the setpoint of this shot if it is not saved yet
       } else {
         // No countdown value set: do not start the countdown
-        Serial.println("Encoder switch pressed, but no countdown value set. Relay not activated.");
+        LOG_INFO("Encoder switch pressed, but no countdown value set. Relay not activated.");
       }
     } else {
       // If countdown is active, stop the countdown
-      Serial.println("Encoder switch pressed. Countdown stopped.");
-      counting = false;
-      digitalWrite(RELAY_PIN, HIGH); // Turn off the relay (active-low)
+      LOG_INFO("Encoder switch pressed. Countdown stopped.");
+      countdownStop(); // Turns off the relay
       updateDisplay(0); // Clear the display
       currentCount = 0; // Reset the countdown value to 0
     }
-    delay(50); // Short delay to debounce the switch
   }
   lastSwitchState = currentSwitchState;
 
+  // Steps turned during a countdown are dropped, as before
+  int steps = encoderRead();
   if (!counting) {
-    // Handle encoder rotation with improved debouncing
-    int currentA = digitalRead(ENCODER_PIN_A);
-    if (currentA != lastA) {
-      if (millis() - lastEncoderChange > debounceDelay) { // Debounce check
-        if (digitalRead(ENCODER_PIN_A) == LOW) {
-          if (digitalRead(ENCODER_PIN_B) == HIGH) {
-            // Clockwise rotation: increment the countdown value
-            currentCount = (currentCount + 1) % (maxCount + 1); // Increment, wrap at maxCount
-            Serial.print("Encoder turned clockwise. Current count: ");
-            Serial.println(currentCount);
-          } else {
-            // Counter-clockwise rotation: decrement the countdown value
-            currentCount = (currentCount - 1 + (maxCount + 1)) % (maxCount + 1); // Decrement, wrap at 0
-            Serial.print("Encoder turned counter-clockwise. Current count: ");
-            Serial.println(currentCount);
-          }
-          updateDisplay(currentCount); // Update the display with the new countdown value
-          // Save the current countdown value to EEPROM
-          EEPROM.write(eepromAddress, currentCount);
-        }
-        lastEncoderChange = millis(); // Update the last encoder change timestamp
+    if (steps == 1 || steps == -1) {
+      // Single detent: wrap around at 0 and maxCount
+      currentCount = (currentCount + steps + (maxCount + 1)) % (maxCount + 1);
+    } else if (steps != 0) {
+      // Several detents or an accelerated one: stop at the ends of the range
+      currentCount = constrain(currentCount + steps, 0, maxCount);
+    }
+    if (steps != 0) {
+      if (steps > 0) {
+        LOG_DEBUG("Encoder turned clockwise. Current count: ", currentCount);
+      } else {
+        LOG_DEBUG("Encoder turned counter-clockwise. Current count: ", currentCount);
       }
-      lastA = currentA; // Update the last state of ENCODER_PIN_A
+      updateDisplay(currentCount); // Update the display with the new countdown value
+      setpoint = currentCount;
+      setpointChanged = true;
+      lastKnobChange = millis(); // Saved once the knob rests, see below
+    }
+    if (setpointChanged && millis() - lastKnobChange >= saveDelay) {
+      setpointSave();
     }
   } else {
-    // Handle the countdown
-    if (millis() - previousMillis >= interval) {
-      previousMillis = millis();
-      currentCount--; // Decrement the countdown value
-      Serial.print("Counting down. Current value: ");
-      Serial.println(currentCount);
-      updateDisplay(currentCount); // Update the display with the new countdown value
-      if (currentCount <= 0) {
-        // Countdown finished
-        Serial.println("Countdown finished. Relay turned off.");
-        counting = false;
-        digitalWrite(RELAY_PIN, HIGH); // Turn off the relay (active-low)
-        updateDisplay(0); // Clear the display
-        currentCount = 0; // Reset the countdown value to 0
+    // Follow the countdown run by the timer interrupt
+    static unsigned int shownTenths = 0;
+    unsigned int tenths = countdownLeft();
+    if (tenths != shownTenths) {
+      shownTenths = tenths;
+      updateDisplayTenths(tenths); // Update the display with the time left
+      int seconds = (tenths + 9) / 10;
+      if (seconds != currentCount) {
+        currentCount = seconds;
+        LOG_DEBUG("Counting down. Current value: ", currentCount);
+      }
+    }
+  }
+
+  if (countdownDone) {
+    // Countdown finished, the interrupt has turned the relay off already
+    countdownDone = false;
+    LOG_INFO("Countdown finished. Relay turned off.");
+    updateDisplay(0); // Clear the display
+    currentCount = 0; // Reset the countdown value to 0
+  }
+
+  // Power down once nothing has happened for idleTimeout
+  if (counting || steps != 0 || currentSwitchState == LOW) {
+    lastActivity = millis();
+  }
+  if (millis() - lastActivity >= idleTimeout) {
+    sleepUntilInput();
+    lastActivity = millis();
+  }
+
+  logDrain(); // Send what fits into the TX buffer
+}
+
+// Blank the display and sleep in power-down mode until the encoder or the switch
+// changes. The pin change interrupt that wakes the ATmega is the one of the
+// decoder, so the edge that woke it already counts towards the first detent,
+// and a press is still held when loop() reads the switch about 1 ms later.
+void sleepUntilInput() {
+  setpointSave(); // The supply may be cut while asleep
+  LOG_INFO("Idle. Sleeping until the encoder or switch is used.");
+  logFlush(); // The UART stops in power-down
+
+  uint8_t timer2 = TIMSK2;
+  TIMSK2 = 0; // No brightness slots while blank
+  displaySend(blankDigit, blankDigit);
+  *digitalPinToPCMSK(ENCODER_SWITCH) |= bit(digitalPinToPCMSKbit(ENCODER_SWITCH));
+  uint8_t adc = ADCSRA;
+  ADCSRA = 0; // The ADC is not used, and would draw current in sleep
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  cli();
+  if (encoderSteps == 0 && digitalRead(ENCODER_SWITCH) == HIGH) { // Nothing arrived meanwhile
+    sleep_enable();
+    sleep_bod_disable(); // Brown-out detector off while asleep
+    sei(); // The instruction after sei() still runs, so no wake-up is missed
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
+
+  ADCSRA = adc;
+  *digitalPinToPCMSK(ENCODER_SWITCH) &= ~bit(digitalPinToPCMSKbit(ENCODER_SWITCH));
+  displaySend(displayFrame[0], displayFrame[1]);
+  TIMSK2 = timer2;
+  LOG_INFO("Awake.");
+}
+
+// Turn on the relay and let Timer1 count 'tenths' ticks from now
+void countdownStart(unsigned int tenths) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    tenthsLeft = tenths;
+    counting = true;
+    countdownDone = false;
+    TCCR1A = 0;
+    TCCR1B = bit(WGM12); // CTC mode, stopped
+    TCNT1 = 0;
+    OCR1A = tickCompare;
+    TIFR1 = bit(OCF1A);
+    TIMSK1 = bit(OCIE1A);
+    digitalWrite(RELAY_PIN, LOW); // Turn on the relay (active-low)
+    TCCR1B = bit(WGM12) | bit(CS12); // Start with prescaler 256, the first tick is 100 ms away
+  }
+}
+
+// Turn off the relay before the countdown has run out
+void countdownStop() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR1B = 0;
+    TIMSK1 = 0;
+    digitalWrite(RELAY_PIN, HIGH); // Turn off the relay (active-low)
+    counting = false;
+    tenthsLeft = 0;
+  }
+}
+
+// Tenths of a second left of the running countdown
+unsigned int countdownLeft() {
+  unsigned int tenths;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    tenths = tenthsLeft;
+  }
+  return tenths;
+}
+
+ISR(TIMER1_COMPA_vect) {
+  if (tenthsLeft > 0 && --tenthsLeft == 0) {
+    digitalWrite(RELAY_PIN, HIGH); // Turn off the relay (active-low) on the last tick
+    TCCR1B = 0;
+    TIMSK1 = 0;
+    counting = false;
+    countdownDone = true;
+  }
+}
+
+// Set up the pin change interrupt for both encoder pins. Pins 5 and 6 of the Uno
+// are PD5 and PD6, PCINT21 and PCINT22 in the PCINT2 group.
+void encoderBegin() {
+  encoderPort = portInputRegister(digitalPinToPort(ENCODER_PIN_A));
+  encoderMaskA = digitalPinToBitMask(ENCODER_PIN_A);
+  encoderMaskB = digitalPinToBitMask(ENCODER_PIN_B);
+  uint8_t pins = *encoderPort;
+  encoderState = (pins & encoderMaskA ? 2 : 0) | (pins & encoderMaskB ? 1 : 0);
+  *digitalPinToPCMSK(ENCODER_PIN_A) |= bit(digitalPinToPCMSKbit(ENCODER_PIN_A));
+  *digitalPinToPCMSK(ENCODER_PIN_B) |= bit(digitalPinToPCMSKbit(ENCODER_PIN_B));
+  PCIFR = bit(digitalPinToPCICRbit(ENCODER_PIN_A)); // Drop a change flagged before now
+  PCICR |= bit(digitalPinToPCICRbit(ENCODER_PIN_A));
+}
+
+// Every edge on A or B ends up here. Both pins are read in one go, so the new
+// state is consistent even if the other pin changes right after.
+ISR(PCINT2_vect) {
+  uint8_t pins = *encoderPort;
+  uint8_t state = (pins & encoderMaskA ? 2 : 0) | (pins & encoderMaskB ? 1 : 0);
+  encoderSum += quadTable[encoderState << 2 | state];
+  encoderState = state;
+  if (state != encoderRest) {
+    return;
+  }
+  // Back at a detent: one step if the transitions since the last one add up
+  int8_t dir = encoderSum >= encoderMinSum ? 1 : encoderSum <= -encoderMinSum ? -1 : 0;
+  encoderSum = 0;
+  if (dir == 0) {
+    return;
+  }
+  unsigned long now = millis();
+  int8_t weight = 1;
+  if (encoderAcceleration && now - lastDetent < accelTime) {
+    unsigned long gap = now - lastDetent;
+    weight = gap == 0 ? accelMax : min(1 + accelTime / gap, (unsigned long)accelMax);
+  }
+  lastDetent = now;
+  encoderSteps += dir * weight;
+}
+
+// Detents turned since the last call, positive clockwise
+int encoderRead() {
+  int steps;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    steps = encoderSteps;
+    encoderSteps = 0;
+  }
+  return steps;
+}
+
+// Find the newest valid slot of the ring and return its setpoint. Without one,
+// the byte at eepromAddress is taken, where earlier versions kept the setpoint.
+int setpointLoad() {
+  bool found = false;
+  for (int i = 0; i < setpointSlots; i++) {
+    SetpointSlot slot;
+    EEPROM.get(eepromAddress + i * sizeof(SetpointSlot), slot);
+    if (slot.check != setpointCheck(slot)) {
+      continue; // Erased, or power was lost while writing it
+    }
+    // Valid slots are at most setpointSlots apart, so the difference tells the newer one
+    if (!found || (int16_t)(slot.seq - setpointSeq) > 0) {
+      setpointSeq = slot.seq;
+      savedCount = slot.value;
+      found = true;
+    }
+  }
+  return found ? savedCount : EEPROM.read(eepromAddress);
+}
+
+// Write the setpoint to the slot after the newest one if the knob moved since
+// the last save and the value differs from the saved one. currentCount is not
+// saved, it is the time left or 0 after a countdown. EEPROM.put() skips bytes
+// that do not change.
+void setpointSave() {
+  if (!setpointChanged) {
+    return;
+  }
+  setpointChanged = false;
+  if (setpoint == savedCount) {
+    return; // Turned back to the saved value
+  }
+  SetpointSlot slot;
+  slot.seq = setpointSeq + 1;
+  slot.value = setpoint;
+  slot.check = setpointCheck(slot);
+  EEPROM.put(eepromAddress + (slot.seq % setpointSlots) * sizeof(SetpointSlot), slot);
+  setpointSeq = slot.seq;
+  savedCount = setpoint;
+  LOG_INFO("Setpoint saved: ", setpoint);
+}
+
+// Checksum over sequence number and value. Never 0xFF for an erased slot.
+uint8_t setpointCheck(const SetpointSlot &slot) {
+  return (uint8_t)(lowByte(slot.seq) + highByte(slot.seq) + slot.value) ^ 0xA5;
+}
+
+void logBegin() {
+#if LOG_LEVEL > LOG_LEVEL_NONE
+  Serial.begin(9600);
+#endif
+}
+
+// Queue a message. A full queue drops it. Once there is room again, the number
+// of dropped messages is queued first.
+void logQueue(const char *text, int value, bool hasValue) {
+  if (logCount + (logDropped ? 2 : 1) > logSize) {
+    logDropped++;
+    return;
+  }
+  if (logDropped) {
+    LogRecord &r = logRing[(logHead + logCount++) % logSize];
+    r.text = PSTR("Log messages dropped: ");
+    r.value = logDropped;
+    r.hasValue = true;
+    logDropped = 0;
+  }
+  LogRecord &r = logRing[(logHead + logCount++) % logSize];
+  r.text = text;
+  r.value = value;
+  r.hasValue = hasValue;
+}
+
+void logPut(const char *text) {
+  logQueue(text, 0, false);
+}
+
+// 'text' followed by 'value'
+void logPut(const char *text, int value) {
+  logQueue(text, value, true);
+}
+
+// Write out queued messages character by character while the TX buffer has room
+void logDrain() {
+#if LOG_LEVEL > LOG_LEVEL_NONE
+  while (logCount > 0 && Serial.availableForWrite() > 0) {
+    const LogRecord &r = logRing[logHead];
+    char c = logTailPos < 0 ? pgm_read_byte(r.text + logPos) : 0;
+    if (c) {
+      logPos++;
+    } else {
+      if (logTailPos < 0) { // Text done, the number and the line end follow
+        logTail[0] = 0;
+        if (r.hasValue) {
+          itoa(r.value, logTail, 10);
+        }
+        strcat(logTail, "\r\n");
+        logTailPos = 0;
+      }
+      c = logTail[logTailPos++];
+      if (logTail[logTailPos] == 0) { // Last character, the next message follows
+        logHead = (logHead + 1) % logSize;
+        logCount--;
+        logPos = 0;
+        logTailPos = -1;
       }
     }
+    Serial.write(c);
   }
+#endif
+}
+
+// Wait until all queued messages are sent
+void logFlush() {
+#if LOG_LEVEL > LOG_LEVEL_NONE
+  while (logCount > 0) {
+    logDrain();
+  }
+  Serial.flush();
+#endif
 }
 
 // Function to update the 7-segment display
@@ -155,8 +561,88 @@ void updateDisplay(int number) {
   int digit2 = number % 10; // Extract the ones digit
 
   // Send the digit patterns to the shift register
-  uint8_t numberToPrint[] = {numberB[digit1], numberB[digit2]};
-  sr.setAll(numberToPrint); // Update both digits
+  displayShow(blankLeadingZero && digit1 == 0 ? blankDigit : numberB[digit1], numberB[digit2]);
+}
+
+// Show the time left of a countdown. From 10 s on in whole seconds, rounded up
+// like the setpoint; below that as 9.9 to 0.1 with the decimal point of the
+// first digit, unless showTenths is off.
+void updateDisplayTenths(unsigned int tenths) {
+  if (!showTenths || tenths >= 100) {
+    updateDisplay((tenths + 9) / 10);
+    return;
+  }
+  // Bit 7 is the decimal point, LOW lights it like the segments
+  displayShow(numberB[tenths / 10] & B01111111, numberB[tenths % 10]);
+}
+
+void displayBegin() {
+  pinMode(DIO, OUTPUT);
+  pinMode(CLK, OUTPUT);
+  pinMode(LOAD, OUTPUT);
+  PORTD &= ~(dioMask | clkMask | loadMask);
+}
+
+// Show segment patterns, bit 7 is the decimal point, LOW lights a segment
+void displayShow(uint8_t digit1, uint8_t digit2) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    displayFrame[0] = digit1;
+    displayFrame[1] = digit2;
+    if (displayBrightness[0] == brightnessMax && displayBrightness[1] == brightnessMax) {
+      displaySend(digit1, digit2);
+    } // Otherwise the next brightness slot sends it
+  }
+}
+
+// Brightness of each digit, 0 (off) to brightnessMax
+void displaySetBrightness(uint8_t digit1, uint8_t digit2) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    displayBrightness[0] = min(digit1, brightnessMax);
+    displayBrightness[1] = min(digit2, brightnessMax);
+    if (displayBrightness[0] == brightnessMax && displayBrightness[1] == brightnessMax) {
+      TIMSK2 = 0; // Steady frame, no slots needed
+      TCCR2B = 0;
+      displaySend(displayFrame[0], displayFrame[1]);
+    } else {
+      TCCR2A = bit(WGM21);      // CTC mode
+      OCR2A = F_CPU / 64 / 2000 - 1; // 0.5 ms with prescaler 64
+      TIMSK2 = bit(OCIE2A);
+      TCCR2B = bit(CS22);       // Prescaler 64
+    }
+  }
+}
+
+// Clock out both digits and latch them, the second digit first as the
+// ShiftRegister74HC595 library did. Skipped if the registers hold them already.
+void displaySend(uint8_t digit1, uint8_t digit2) {
+  if (digit1 == latchedFrame[0] && digit2 == latchedFrame[1]) {
+    return;
+  }
+  uint8_t bytes[2] = {digit2, digit1};
+  for (uint8_t i = 0; i < 2; i++) {
+    uint8_t b = bytes[i];
+    for (uint8_t m = 0x80; m; m >>= 1) { // MSB first
+      if (b & m) {
+        PORTD |= dioMask;
+      } else {
+        PORTD &= ~dioMask;
+      }
+      PORTD |= clkMask;
+      PORTD &= ~clkMask;
+    }
+  }
+  PORTD |= loadMask;
+  PORTD &= ~loadMask;
+  latchedFrame[0] = digit1;
+  latchedFrame[1] = digit2;
+}
+
+// One brightness slot: each digit is shown or blanked for the next 0.5 ms
+ISR(TIMER2_COMPA_vect) {
+  uint8_t slot = brightnessSlot;
+  brightnessSlot = slot + 1 < brightnessMax ? slot + 1 : 0;
+  displaySend(slot < displayBrightness[0] ? displayFrame[0] : blankDigit,
+              slot < displayBrightness[1] ? displayFrame[1] : blankDigit);
 }
 
 /*
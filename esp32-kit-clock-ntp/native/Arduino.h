@@ -0,0 +1,29 @@
+// The few Arduino functions ntp_sync.cpp uses, for building it as a Linux
+// program together with main.cpp in this directory.
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+unsigned long millis();
+void delay(unsigned long ms);
+
+class NativeSerial {
+public:
+    int printf(const char *chFormat, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern NativeSerial Serial;
+
+#endif
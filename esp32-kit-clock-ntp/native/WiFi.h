@@ -0,0 +1,28 @@
+// IPAddress and name lookup of the ESP32 WiFi library, on top of getaddrinfo()
+
+#ifndef WIFI_H
+#define WIFI_H
+
+#include <Arduino.h>
+
+class IPAddress {
+public:
+    IPAddress() { memset(chAddress, 0, 4); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { chAddress[0] = a; chAddress[1] = b; chAddress[2] = c; chAddress[3] = d; }
+    uint8_t operator[](int i) const { return chAddress[i]; }
+    uint8_t &operator[](int i) { return chAddress[i]; }
+    bool operator==(const IPAddress &other) const { return memcmp(chAddress, other.chAddress, 4) == 0; }
+    bool fromString(const char *chText);
+
+private:
+    uint8_t chAddress[4];
+};
+
+class NativeWiFi {
+public:
+    int hostByName(const char *chHost, IPAddress &ip);  // 1 on success, as on the ESP32
+};
+
+extern NativeWiFi WiFi;
+
+#endif
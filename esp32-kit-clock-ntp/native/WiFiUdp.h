@@ -0,0 +1,33 @@
+// WiFiUDP of the ESP32 on a nonblocking BSD socket. parsePacket() takes one
+// datagram, read() and flush() work on it, as on the ESP32.
+
+#ifndef WIFIUDP_H
+#define WIFIUDP_H
+
+#include <WiFi.h>
+
+class WiFiUDP {
+public:
+    uint8_t begin(uint16_t nPort);
+    int beginPacket(IPAddress ip, uint16_t nPort);
+    size_t write(const uint8_t *chData, size_t nLength);
+    int endPacket();
+    int parsePacket();
+    int read(uint8_t *chData, size_t nLength);
+    void flush() { nRxLength = nRxPos = 0; }
+    IPAddress remoteIP() { return ipRemote; }
+    uint16_t remotePort() { return nRemotePort; }
+
+private:
+    int nSocket = -1;
+    IPAddress ipTx;
+    uint16_t nTxPort = 0;
+    uint8_t chTx[512];
+    size_t nTxLength = 0;
+    uint8_t chRx[512];
+    size_t nRxLength = 0, nRxPos = 0;
+    IPAddress ipRemote;
+    uint16_t nRemotePort = 0;
+};
+
+#endif
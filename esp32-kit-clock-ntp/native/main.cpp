@@ -0,0 +1,251 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Runs ntp_sync.cpp as a Linux program against real NTP servers or the stand-in
+// in tools/ntp_standin.py, with a simulated system clock that drifts. Every
+// line of output after the first sync shows how far that clock is off from the
+// clock of this computer, which the stand-in serves.
+//
+// usage: ntp_native [--drift PPM] [--offset MS] [--slew PPM] [--seconds N] [SERVERS]
+//
+//   --drift PPM     the simulated clock runs PPM parts per million fast (default 100)
+//   --offset MS     it starts MS ms ahead of this computer, by default it starts
+//                   at 1970 like the ESP32 after power on
+//   --slew PPM      rate adjtime() corrects at (default 500, like Linux)
+//   --seconds N     stop after N seconds (default 300)
+//   SERVERS         as NTP_SERVERS (default "127.0.0.1:12300,127.0.0.1:12301,127.0.0.1:12302")
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <WiFiUdp.h>
+#include "ntp_sync.h"
+
+NativeSerial Serial;
+NativeWiFi WiFi;
+
+static double dDriftPpm = 100;
+static double dSlewPpm = 500;
+static double dLocalUs;              // Simulated clock, us since 1970
+static double dSlewLeftUs;           // Correction adjtime() still has to make
+static long long llLastMonoUs;       // Monotonic time dLocalUs was advanced to
+
+static long long hostMicros(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Arduino
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned long millis() {
+    return hostMicros(CLOCK_MONOTONIC) / 1000;
+}
+
+void delay(unsigned long ms) {
+    usleep(ms * 1000);
+}
+
+int NativeSerial::printf(const char *chFormat, ...) {
+    va_list args;
+    va_start(args, chFormat);
+    int n = vprintf(chFormat, args);
+    va_end(args);
+    fflush(stdout);
+    return n;
+}
+
+bool IPAddress::fromString(const char *chText) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, chText, &addr) != 1) {
+        return false;
+    }
+    memcpy(chAddress, &addr, 4);
+    return true;
+}
+
+int NativeWiFi::hostByName(const char *chHost, IPAddress &ip) {
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(chHost, NULL, &hints, &result) != 0) {
+        return 0;
+    }
+    const uint8_t *chAddress = (const uint8_t *)&((struct sockaddr_in *)result->ai_addr)->sin_addr;
+    ip = IPAddress(chAddress[0], chAddress[1], chAddress[2], chAddress[3]);
+    freeaddrinfo(result);
+    return 1;
+}
+
+// Falls back to any free port when the one asked for is taken
+uint8_t WiFiUDP::begin(uint16_t nPort) {
+    nSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    fcntl(nSocket, F_SETFL, O_NONBLOCK);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(nPort);
+    if (bind(nSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        addr.sin_port = 0;
+        bind(nSocket, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    return 1;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t nPort) {
+    ipTx = ip;
+    nTxPort = nPort;
+    nTxLength = 0;
+    return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t *chData, size_t nLength) {
+    nLength = min(nLength, sizeof(chTx) - nTxLength);
+    memcpy(chTx + nTxLength, chData, nLength);
+    nTxLength += nLength;
+    return nLength;
+}
+
+int WiFiUDP::endPacket() {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(nTxPort);
+    uint8_t *chAddress = (uint8_t *)&addr.sin_addr;
+    for (int i = 0; i < 4; i++) {
+        chAddress[i] = ipTx[i];
+    }
+    return sendto(nSocket, chTx, nTxLength, 0, (struct sockaddr *)&addr, sizeof(addr)) == (ssize_t)nTxLength;
+}
+
+int WiFiUDP::parsePacket() {
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    ssize_t n = recvfrom(nSocket, chRx, sizeof(chRx), 0, (struct sockaddr *)&addr, &addrLength);
+    if (n <= 0) {
+        nRxLength = nRxPos = 0;
+        return 0;
+    }
+    const uint8_t *chAddress = (const uint8_t *)&addr.sin_addr;
+    ipRemote = IPAddress(chAddress[0], chAddress[1], chAddress[2], chAddress[3]);
+    nRemotePort = ntohs(addr.sin_port);
+    nRxLength = n;
+    nRxPos = 0;
+    return n;
+}
+
+int WiFiUDP::read(uint8_t *chData, size_t nLength) {
+    nLength = min(nLength, nRxLength - nRxPos);
+    memcpy(chData, chRx + nRxPos, nLength);
+    nRxPos += nLength;
+    return nLength;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Simulated system clock, replaces the weak ESP32 versions in ntp_sync.cpp
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void advanceClock() {
+    long long llMonoUs = hostMicros(CLOCK_MONOTONIC);
+    double dElapsed = llMonoUs - llLastMonoUs;
+    llLastMonoUs = llMonoUs;
+    dLocalUs += dElapsed * (1 + dDriftPpm / 1e6);
+    double dSlew = min(dElapsed * dSlewPpm / 1e6, dSlewLeftUs < 0 ? -dSlewLeftUs : dSlewLeftUs);
+    dSlew = dSlewLeftUs < 0 ? -dSlew : dSlew;
+    dLocalUs += dSlew;
+    dSlewLeftUs -= dSlew;
+}
+
+void ntpClockGet(struct timeval *tv) {
+    advanceClock();
+    long long llLocal = (long long)dLocalUs;
+    tv->tv_sec = llLocal / 1000000;
+    tv->tv_usec = llLocal % 1000000;
+}
+
+void ntpClockStep(const struct timeval *tv) {
+    advanceClock();
+    dLocalUs = (double)tv->tv_sec * 1000000 + tv->tv_usec;
+    dSlewLeftUs = 0;                             // settimeofday() ends a slew in progress
+}
+
+void ntpClockSlew(const struct timeval *delta) {
+    advanceClock();
+    dSlewLeftUs = (double)delta->tv_sec * 1000000 + delta->tv_usec; // Replaces one in progress
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+    const char *chServers = "127.0.0.1:12300,127.0.0.1:12301,127.0.0.1:12302";
+    double dOffsetMs = 0;
+    bool bOffset = false;
+    long lSeconds = 300;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--drift") && i + 1 < argc) {
+            dDriftPpm = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--offset") && i + 1 < argc) {
+            dOffsetMs = atof(argv[++i]);
+            bOffset = true;
+        } else if (!strcmp(argv[i], "--slew") && i + 1 < argc) {
+            dSlewPpm = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            lSeconds = atol(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            chServers = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--drift PPM] [--offset MS] [--slew PPM] [--seconds N] [SERVERS]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    llLastMonoUs = hostMicros(CLOCK_MONOTONIC);
+    dLocalUs = bOffset ? hostMicros(CLOCK_REALTIME) + dOffsetMs * 1000 : 0;
+    printf("servers %s, drift %+.1f ppm, slew %.0f ppm\n", chServers, dDriftPpm, dSlewPpm);
+    ntpBegin(chServers);
+
+    // The loop of the sketch: NTP, then sleep until the next second or NTP event.
+    // The error is printed every 10 s, the largest one after the first 60 s is kept.
+    unsigned long ulStart = millis();
+    unsigned long ulNextReport = 0;
+    double dMaxErrorUs = 0;
+    while (millis() - ulStart < (unsigned long)lSeconds * 1000) {
+        ntpLoop();
+        if (ntpSynced()) {
+            advanceClock();
+            double dErrorUs = dLocalUs - hostMicros(CLOCK_REALTIME);
+            unsigned long ulElapsed = millis() - ulStart;
+            if (ulElapsed >= 60000) {
+                dMaxErrorUs = max(dMaxErrorUs, dErrorUs < 0 ? -dErrorUs : dErrorUs);
+            }
+            if (ulElapsed >= ulNextReport) {
+                ulNextReport = (ulElapsed / 10000 + 1) * 10000;
+                printf("%4lu s: clock error %+8.0f us, slewing %+7.0f us\n", ulElapsed / 1000, dErrorUs, dSlewLeftUs);
+            }
+        }
+        delay(min(ntpMsToNextEvent(), 1000UL));
+    }
+
+    printf("largest error after 60 s: %.0f us\n", dMaxErrorUs);
+    printf("rounds %lu, failed %lu, dns failures %lu, requests %lu, replies %lu, rejected %lu, timeouts %lu, outliers %lu, disagreed %lu, steps %lu, slews %lu\n",
+           ntpStats.nRounds, ntpStats.nFailedRounds, ntpStats.nDnsFailures, ntpStats.nRequests, ntpStats.nReplies,
+           ntpStats.nRejected, ntpStats.nTimeouts, ntpStats.nOutliers, ntpStats.nDisagreed,
+           ntpStats.nSteps, ntpStats.nSlews);
+    return 0;
+}
@@ -7,10 +7,10 @@
 #include <arduino.h>                 // Arduino Core Library
 #include <time.h>                    // Time functions
 #include <WiFi.h>                    // WiFi functions for ESP32
-#include <WiFiUdp.h>                 // UDP for NTP
 #include <U8g2lib.h>                 // Library for OLED display
 #include <ESPAsyncWebServer.h>       // Asynchronous Web Server library
 #include "credentials.h"             // WiFi credentials
+#include "ntp_sync.h"                // NTP synchronization
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -20,9 +20,8 @@
 
 #define FONT_ONE_HEIGHT 8            // Height of smaller font on OLED
 #define FONT_TWO_HEIGHT 20           // Height of larger font on OLED
-#define NTP_DELAY_COUNT 20           // Delay between NTP requests
-#define NTP_PACKET_LENGTH 48         // Length of NTP packet
-#define UDP_PORT 4000                // UDP port for NTP communication
+#define TIME_TILE_ROW 5              // First 8 pixel tile row of the time line (y = 40)
+#define TIME_TILE_ROWS 3             // Tile rows of the time line, down to the bottom
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -30,14 +29,15 @@
 //
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Languages of OLED and web page, the order of the name tables below
+enum Locale { LOCALE_DE, LOCALE_EN };
+
 int currentTimeZone = 1;             // Default time zone offset (CET)
-String oledLanguage = "de";          // Default language for OLED ("de" = German)
+volatile Locale oledLanguage = LOCALE_DE; // Default language for OLED, set by the web server
 
 // Network and display objects
 char chBuffer[128];                  // General-purpose string buffer
-bool bTimeReceived = false;          // Flag to track if NTP time is received
 U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0, 16, 15, 4); // OLED display object
-WiFiUDP Udp;                         // UDP object for NTP
 AsyncWebServer server(80);           // HTTP server object
 
 // Day and month names for display
@@ -45,6 +45,8 @@ const char *wochentage_de[] = {"Sonntag", "Montag", "Dienstag", "Mittwoch", "Don
 const char *wochentage_en[] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
 const char *monate_de[] = {"Januar", "Februar", "März", "April", "Mai", "Juni", "Juli", "August", "September", "Oktober", "November", "Dezember"};
 const char *monate_en[] = {"January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December"};
+const char **wochentage[] = {wochentage_de, wochentage_en};
+const char **monate[] = {monate_de, monate_en};
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -53,10 +55,13 @@ const char *monate_en[] = {"January", "February", "March", "April", "May", "June
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void setTimeZone(int timeZoneOffset);              // Updates the timezone offset
-void updateDisplay(struct tm *tmPointer);          // Updates the OLED display
+void updateDisplay(struct tm *tmPointer);          // Updates the OLED display, once per second
+void drawDateLines(struct tm *tmPointer, Locale locale); // Draws weekday and date into the buffer
+void drawTimeLine(struct tm *tmPointer, Locale locale);  // Draws the time into the buffer
 String generateHTMLPage();                         // Generates the HTML page for the web server
 void handleTimezoneRequest(AsyncWebServerRequest *request); // Handles timezone change requests
 void handleLanguageRequest(AsyncWebServerRequest *request); // Handles language change requests
+void handleNtpRequest(AsyncWebServerRequest *request);      // Reports the NTP statistics
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -109,8 +114,8 @@ void setup() {
     u8g2.drawStr(0, FONT_ONE_HEIGHT * 6, "Awaiting NTP time...");
     u8g2.sendBuffer();                            // Update OLED
 
-    // Start UDP for NTP communication
-    Udp.begin(UDP_PORT);
+    // Start NTP synchronization, the first round is sent from loop()
+    ntpBegin(NTP_SERVERS);
 
     // Configure the web server
     server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -126,10 +131,14 @@ void setup() {
         handleLanguageRequest(request);
     });
 
+    server.on("/ntp", HTTP_GET, [](AsyncWebServerRequest *request) {
+        handleNtpRequest(request);
+    });
+
     server.begin();                               // Start the server
     Serial.println("Webserver gestartet.");
 
-    // Initialize NTP time
+    // Initialize time zone
     setTimeZone(currentTimeZone);
 }
 
@@ -140,41 +149,28 @@ void setup() {
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void loop() {
-    static byte chNtpPacket[NTP_PACKET_LENGTH];   // Buffer for NTP packet
-    static int nNtpDelay = NTP_DELAY_COUNT;      // Counter for NTP request delay
-
-    // Request and process NTP time if not received yet
-    if (!bTimeReceived) {
-        nNtpDelay++;
-        if (nNtpDelay >= NTP_DELAY_COUNT) {
-            nNtpDelay = 0;
-            memset(chNtpPacket, 0, NTP_PACKET_LENGTH); // Clear packet
-            chNtpPacket[0] = 0b11100011;          // NTP packet header
-            IPAddress ipNtpServer(116, 203, 244, 102); // NTP server ubnt.pool.ntp.org
-            Udp.beginPacket(ipNtpServer, 123);    // Send packet to NTP server
-            Udp.write(chNtpPacket, NTP_PACKET_LENGTH);
-            Udp.endPacket();
-        }
+    ntpLoop();                                    // Poll, receive and correct the clock
 
-        if (Udp.parsePacket()) {                  // Process incoming NTP response
-            Udp.read(chNtpPacket, NTP_PACKET_LENGTH);
-            unsigned long secsSince1900 = (unsigned long)chNtpPacket[40] << 24 |
-                                          (unsigned long)chNtpPacket[41] << 16 |
-                                          (unsigned long)chNtpPacket[42] << 8 |
-                                          (unsigned long)chNtpPacket[43];
-            struct timeval tv = {(secsSince1900 - 2208988800UL), 0}; // Convert NTP time
-            settimeofday(&tv, NULL);             // Set system time
-            bTimeReceived = true;
-        }
-    }
-
-    // Update OLED display
-    if (bTimeReceived) {
+    // Update OLED display when the second changes, then sleep until the next
+    // second or the next NTP event, whichever comes first
+    unsigned long ulSleepMs = ntpMsToNextEvent();
+    if (ntpSynced()) {
+        static time_t shownSecond = 0;
         struct timeval tv;
         gettimeofday(&tv, NULL);
-        struct tm *tmPointer = localtime(&tv.tv_sec);
-        updateDisplay(tmPointer);
+        if (tv.tv_sec != shownSecond) {
+            shownSecond = tv.tv_sec;
+            struct tm *tmPointer = localtime(&tv.tv_sec);
+            updateDisplay(tmPointer);
+            gettimeofday(&tv, NULL);
+        }
+        if (tv.tv_sec == shownSecond) {
+            ulSleepMs = min(ulSleepMs, (unsigned long)(1000 - tv.tv_usec / 1000));
+        } else {
+            ulSleepMs = 0;                        // Drawing took into the next second
+        }
     }
+    delay(ulSleepMs);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -185,36 +181,64 @@ void loop() {
 
 void setTimeZone(int timeZoneOffset) {
     currentTimeZone = timeZoneOffset;            // Update global timezone
-    configTime(currentTimeZone * 3600, 0, "ubnt.pool.ntp.org"); // Set timezone and NTP server
+    // POSIX TZ counts west of UTC positive. configTime() is not used, it
+    // would start the SNTP client of the IDF next to ntp_sync
+    char chTz[16];                               // Not chBuffer, this runs in the web server task
+    sprintf(chTz, "UTC%+d", -currentTimeZone);
+    setenv("TZ", chTz, 1);
+    tzset();
     Serial.printf("Zeitzone aktualisiert auf: %d\n", currentTimeZone);
 }
 
+// Weekday and date are drawn only when the day or the language changes, the
+// whole frame is sent then. Otherwise only the time line is redrawn and just
+// its tile rows are sent over I2C.
 void updateDisplay(struct tm *tmPointer) {
-    u8g2.clearBuffer();
+    static int shownDay = -1;                    // Day of the date lines on the OLED
+    static Locale shownLanguage = LOCALE_DE;
+    Locale locale = oledLanguage;
+    int day = (tmPointer->tm_year + 1900) * 400 + tmPointer->tm_yday;
+    if (day != shownDay || locale != shownLanguage) {
+        shownDay = day;
+        shownLanguage = locale;
+        u8g2.clearBuffer();
+        drawDateLines(tmPointer, locale);
+        drawTimeLine(tmPointer, locale);
+        u8g2.sendBuffer();                       // Send the whole buffer
+        return;
+    }
+
+    u8g2.setDrawColor(0);                        // Clear the time line
+    u8g2.drawBox(0, TIME_TILE_ROW * 8, 128, TIME_TILE_ROWS * 8);
+    u8g2.setDrawColor(1);
+    drawTimeLine(tmPointer, locale);
+    u8g2.updateDisplayArea(0, TIME_TILE_ROW, 16, TIME_TILE_ROWS); // Send its tile rows only
+}
 
+void drawDateLines(struct tm *tmPointer, Locale locale) {
     // Line 1: Day of the week
-    const char **wochentage = (oledLanguage == "de") ? wochentage_de : wochentage_en;
-    const char *wochentag = wochentage[tmPointer->tm_wday];
+    const char *wochentag = wochentage[locale][tmPointer->tm_wday];
     u8g2.setFont(u8g2_font_6x10_tr);
     u8g2.drawStr(64 - (u8g2.getStrWidth(wochentag) / 2), 2, wochentag);
 
     // Line 2: Date
-    const char **monate = (oledLanguage == "de") ? monate_de : monate_en; // Choose month names based on language.
-    if (oledLanguage == "de") {
+    if (locale == LOCALE_DE) {
     // German format: Day. Month Year
-    sprintf(chBuffer, "%d. %s %d", tmPointer->tm_mday, monate[tmPointer->tm_mon], tmPointer->tm_year + 1900);
+    sprintf(chBuffer, "%d. %s %d", tmPointer->tm_mday, monate[locale][tmPointer->tm_mon], tmPointer->tm_year + 1900);
     } else {
     // English format: Year, Month Day
-    sprintf(chBuffer, "%d, %s %d.", tmPointer->tm_year + 1900, monate[tmPointer->tm_mon], tmPointer->tm_mday);
+    sprintf(chBuffer, "%d, %s %d.", tmPointer->tm_year + 1900, monate[locale][tmPointer->tm_mon], tmPointer->tm_mday);
     }
     // Center-align the date on the display at y=15.
     u8g2.drawStr(64 - (u8g2.getStrWidth(chBuffer) / 2), 15, chBuffer);
+}
 
+void drawTimeLine(struct tm *tmPointer, Locale locale) {
     // Line 3: Time (hour:minute:second)
     // Determine the time format based on the language setting.
-    if (oledLanguage == "de") {
+    u8g2.setFont(u8g2_font_logisoso18_tf); // Use a large font for the time.
+    if (locale == LOCALE_DE) {
         // For German: Use 24-hour format.
-        u8g2.setFont(u8g2_font_logisoso18_tf); // Use a large font for the time.
         sprintf(chBuffer, "%02d:%02d:%02d", tmPointer->tm_hour, tmPointer->tm_min, tmPointer->tm_sec); // Format: HH:MM:SS.
     } else {
         // For English: Use 12-hour format with AM/PM.
@@ -225,18 +249,15 @@ void updateDisplay(struct tm *tmPointer) {
             if (hour > 12) hour -= 12; // Convert to 12-hour format.
         }
         if (hour == 0) hour = 12; // Handle midnight as 12 AM.
-        u8g2.setFont(u8g2_font_logisoso18_tf); // Use a large font for the time.
         sprintf(chBuffer, "%02d:%02d:%02d%s", hour, tmPointer->tm_min, tmPointer->tm_sec, am_pm); // Format: HH:MM:SS AM/PM.
     }
     u8g2.drawStr(64 - (u8g2.getStrWidth(chBuffer) / 2), 63 - FONT_TWO_HEIGHT, chBuffer); // Center-align the time on the display
-
-    u8g2.sendBuffer(); // Send the buffer to the OLED to update the display.
 }
 
 String generateHTMLPage() {
     String html = "<html><body>";
     
-    if (oledLanguage == "de") {
+    if (oledLanguage == LOCALE_DE) {
         html += "<h1>ESP32 Einstellungen</h1>";
         html += "<form action='/setTimezone' method='get'>";
         html += "Zeitzone (z.B. CET = 1): <input type='number' name='tz' required>";
@@ -245,14 +266,14 @@ String generateHTMLPage() {
         html += "<form action='/setLanguage' method='get'>";
         html += "Sprache: ";
         html += "<input type='radio' name='lang' value='de'";
-        if (oledLanguage == "de") html += " checked";
+        if (oledLanguage == LOCALE_DE) html += " checked";
         html += "> Deutsch";
         html += "<input type='radio' name='lang' value='en'";
-        if (oledLanguage == "en") html += " checked";
+        if (oledLanguage == LOCALE_EN) html += " checked";
         html += "> Englisch";
         html += "<button type='submit'>Sprache aendern</button>";
         html += "</form>";
-    } else if (oledLanguage == "en") {
+    } else {
         html += "<h1>ESP32 Settings</h1>";
         html += "<form action='/setTimezone' method='get'>";
         html += "Timezone (e.g., CET = 1): <input type='number' name='tz' required>";
@@ -261,15 +282,16 @@ String generateHTMLPage() {
         html += "<form action='/setLanguage' method='get'>";
         html += "Language: ";
         html += "<input type='radio' name='lang' value='de'";
-        if (oledLanguage == "de") html += " checked";
+        if (oledLanguage == LOCALE_DE) html += " checked";
         html += "> German";
         html += "<input type='radio' name='lang' value='en'";
-        if (oledLanguage == "en") html += " checked";
+        if (oledLanguage == LOCALE_EN) html += " checked";
         html += "> English";
         html += "<button type='submit'>Change Language</button>";
         html += "</form>";
     }
 
+    html += "<p><a href='/ntp'>NTP</a></p>";
     html += "</body></html>";
     return html;
 }
@@ -288,9 +310,44 @@ void handleTimezoneRequest(AsyncWebServerRequest *request) {
 
 void handleLanguageRequest(AsyncWebServerRequest *request) {
     if (request->hasParam("lang")) {
-        oledLanguage = request->getParam("lang")->value();
-        request->send(200, "text/plain", "Sprache auf " + oledLanguage + " gesetzt.");
+        String lang = request->getParam("lang")->value();
+        if (lang == "de") {
+            oledLanguage = LOCALE_DE;
+        } else if (lang == "en") {
+            oledLanguage = LOCALE_EN;
+        } else {
+            request->send(400, "text/plain", "Fehler: Unbekannte Sprache " + lang + ".");
+            return;
+        }
+        request->send(200, "text/plain", "Sprache auf " + lang + " gesetzt."); // OLED follows within a second
     } else {
         request->send(400, "text/plain", "Fehler: Keine Sprache angegeben.");
     }
 }
+
+// Plain text, one value per line, for curl or a monitoring script
+void handleNtpRequest(AsyncWebServerRequest *request) {
+    String text;
+    char chLine[96];
+    IPAddress &ip = ntpStats.ipServer;
+    snprintf(chLine, sizeof(chLine), "synced %d\n", ntpSynced()); text += chLine;
+    snprintf(chLine, sizeof(chLine), "server %d.%d.%d.%d\n", ip[0], ip[1], ip[2], ip[3]); text += chLine;
+    snprintf(chLine, sizeof(chLine), "stratum %d\n", ntpStats.nStratum); text += chLine;
+    snprintf(chLine, sizeof(chLine), "offset_us %lld\n", ntpStats.llOffsetUs); text += chLine;
+    snprintf(chLine, sizeof(chLine), "delay_us %ld\n", ntpStats.lDelayUs); text += chLine;
+    snprintf(chLine, sizeof(chLine), "last_sync_s %lu\n",
+             ntpStats.ulSyncMillis ? (millis() - ntpStats.ulSyncMillis) / 1000 : 0); text += chLine;
+    snprintf(chLine, sizeof(chLine), "poll_s %lu\n", ntpStats.ulPollS); text += chLine;
+    snprintf(chLine, sizeof(chLine), "rounds %lu\n", ntpStats.nRounds); text += chLine;
+    snprintf(chLine, sizeof(chLine), "failed_rounds %lu\n", ntpStats.nFailedRounds); text += chLine;
+    snprintf(chLine, sizeof(chLine), "dns_failures %lu\n", ntpStats.nDnsFailures); text += chLine;
+    snprintf(chLine, sizeof(chLine), "requests %lu\n", ntpStats.nRequests); text += chLine;
+    snprintf(chLine, sizeof(chLine), "replies %lu\n", ntpStats.nReplies); text += chLine;
+    snprintf(chLine, sizeof(chLine), "rejected %lu\n", ntpStats.nRejected); text += chLine;
+    snprintf(chLine, sizeof(chLine), "timeouts %lu\n", ntpStats.nTimeouts); text += chLine;
+    snprintf(chLine, sizeof(chLine), "outliers %lu\n", ntpStats.nOutliers); text += chLine;
+    snprintf(chLine, sizeof(chLine), "disagreed %lu\n", ntpStats.nDisagreed); text += chLine;
+    snprintf(chLine, sizeof(chLine), "steps %lu\n", ntpStats.nSteps); text += chLine;
+    snprintf(chLine, sizeof(chLine), "slews %lu\n", ntpStats.nSlews); text += chLine;
+    request->send(200, "text/plain", text);
+}
@@ -0,0 +1,352 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// NTP synchronization, see ntp_sync.h
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <WiFiUdp.h>
+#include "ntp_sync.h"
+
+#define NTP_PACKET_LENGTH 48         // Length of NTP packet without extensions
+#define NTP_PORT 123
+#define NTP_UNIX_OFFSET 2208988800LL // Seconds from 1900 to 1970
+
+struct NtpServer {
+    char chName[48];                 // Host name or address as configured
+    uint16_t nPort;
+    IPAddress ip;                    // Address in this round
+    bool bPending;                   // Request sent, no reply yet
+    byte chOrigin[8];                // Transmit timestamp of the request, the reply must echo it
+    long long llT1;                  // Local time the request was sent, us since 1970
+};
+
+struct NtpSample {
+    long long llOffsetUs;
+    long long llDelayUs;
+    int nServer;
+    int nStratum;
+};
+
+NtpStats ntpStats;
+
+static WiFiUDP ntpUdp;
+static NtpServer servers[NTP_MAX_SERVERS];
+static int nServers = 0;
+static NtpSample samples[NTP_MAX_SERVERS];
+static int nSamples = 0;
+static bool bSynced = false;
+static bool bRoundOpen = false;      // Requests out, waiting for replies
+static unsigned long ulRoundStart = 0; // millis() the round was sent
+static unsigned long ulNextRound = 0;  // millis() the next round is due
+static unsigned long ulRetryS = 0;   // Retry interval after failed rounds, 0 after a good one
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// System clock
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+__attribute__((weak)) void ntpClockGet(struct timeval *tv) {
+    gettimeofday(tv, NULL);
+}
+
+__attribute__((weak)) void ntpClockStep(const struct timeval *tv) {
+    settimeofday(tv, NULL);
+}
+
+__attribute__((weak)) void ntpClockSlew(const struct timeval *delta) {
+    adjtime(delta, NULL);
+}
+
+static long long localMicros() {
+    struct timeval tv;
+    ntpClockGet(&tv);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Timestamps: 32 bit seconds since 1900 and 32 bit fraction, big endian
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void putTimestamp(byte *p, long long llMicros) {
+    unsigned long ulSecs = (unsigned long)(llMicros / 1000000 + NTP_UNIX_OFFSET);
+    unsigned long ulFrac = (unsigned long)(((unsigned long long)(llMicros % 1000000) << 32) / 1000000);
+    for (int i = 0; i < 4; i++) {
+        p[i] = ulSecs >> (24 - 8 * i);
+        p[4 + i] = ulFrac >> (24 - 8 * i);
+    }
+}
+
+// Seconds with the top bit clear are taken as era 1, from 2036 on (RFC 4330)
+static long long getTimestamp(const byte *p) {
+    unsigned long ulSecs = 0, ulFrac = 0;
+    for (int i = 0; i < 4; i++) {
+        ulSecs = ulSecs << 8 | p[i];
+        ulFrac = ulFrac << 8 | p[4 + i];
+    }
+    long long llSecs = ulSecs;
+    if (!(ulSecs & 0x80000000UL)) {
+        llSecs += 1LL << 32;
+    }
+    return (llSecs - NTP_UNIX_OFFSET) * 1000000 + (long long)(((unsigned long long)ulFrac * 1000000) >> 32);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Poll rounds
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ntpBegin(const char *chServers) {
+    nServers = 0;
+    const char *p = chServers;
+    while (*p && nServers < NTP_MAX_SERVERS) {
+        size_t len = strcspn(p, ",");
+        NtpServer &s = servers[nServers];
+        snprintf(s.chName, sizeof(s.chName), "%.*s", (int)len, p);
+        s.nPort = NTP_PORT;
+        char *colon = strchr(s.chName, ':');
+        if (colon) {
+            *colon = 0;
+            s.nPort = atoi(colon + 1);
+        }
+        if (s.chName[0]) {
+            nServers++;
+        }
+        p += len + (p[len] ? 1 : 0);
+    }
+    ntpUdp.begin(NTP_LOCAL_PORT);
+    ntpStats.ulPollS = NTP_MIN_POLL_S;
+    ulNextRound = millis();                      // First round right away
+}
+
+bool ntpSynced() {
+    return bSynced;
+}
+
+// Resolve all names again, as pool names rotate, then send one request to each
+// address. Names resolving to an address asked already in this round are skipped.
+// All lookups come first: hostByName() blocks, and a reply waiting in the UDP
+// buffer meanwhile would get a late T4.
+static void startRound() {
+    ntpStats.nRounds++;
+    nSamples = 0;
+    bool bSend[NTP_MAX_SERVERS];
+    for (int i = 0; i < nServers; i++) {
+        NtpServer &s = servers[i];
+        s.bPending = false;
+        bSend[i] = false;
+        if (!s.ip.fromString(s.chName) && !WiFi.hostByName(s.chName, s.ip)) {
+            ntpStats.nDnsFailures++;
+            continue;
+        }
+        bSend[i] = true;
+        for (int j = 0; j < i; j++) {
+            if (bSend[j] && servers[j].ip == s.ip && servers[j].nPort == s.nPort) {
+                bSend[i] = false;
+            }
+        }
+    }
+    for (int i = 0; i < nServers; i++) {
+        if (!bSend[i]) {
+            continue;
+        }
+        NtpServer &s = servers[i];
+        byte chPacket[NTP_PACKET_LENGTH];
+        memset(chPacket, 0, NTP_PACKET_LENGTH);
+        chPacket[0] = 0b00100011;                // LI 0, version 4, mode 3 (client)
+        s.llT1 = localMicros();
+        putTimestamp(chPacket + 40, s.llT1);     // Transmit timestamp, echoed as origin
+        memcpy(s.chOrigin, chPacket + 40, 8);
+        ntpUdp.beginPacket(s.ip, s.nPort);
+        ntpUdp.write(chPacket, NTP_PACKET_LENGTH);
+        ntpUdp.endPacket();
+        s.bPending = true;
+        ntpStats.nRequests++;
+    }
+    bRoundOpen = true;
+    ulRoundStart = millis();
+}
+
+// Take a reply if it answers a request of this round. T4 is read first thing,
+// anything that delays the call adds to the delay seen.
+static void receiveReply(int nLength) {
+    long long llT4 = localMicros();
+    byte chPacket[NTP_PACKET_LENGTH];
+    if (nLength < NTP_PACKET_LENGTH) {
+        ntpUdp.flush();
+        ntpStats.nRejected++;
+        return;
+    }
+    ntpUdp.read(chPacket, NTP_PACKET_LENGTH);
+    ntpUdp.flush();                              // Extension fields, if any
+
+    int nServer = -1;
+    for (int i = 0; i < nServers; i++) {
+        NtpServer &s = servers[i];
+        if (s.bPending && s.ip == ntpUdp.remoteIP() && s.nPort == ntpUdp.remotePort() &&
+            memcmp(chPacket + 24, s.chOrigin, 8) == 0) {
+            nServer = i;
+        }
+    }
+    if (nServer < 0) {                           // Late, duplicate or forged
+        ntpStats.nRejected++;
+        return;
+    }
+    NtpServer &s = servers[nServer];
+    s.bPending = false;
+
+    int nLeap = chPacket[0] >> 6;
+    int nMode = chPacket[0] & 7;
+    int nStratum = chPacket[1];
+    if (nMode != 4 || nLeap == 3 || nStratum == 0 || nStratum > 15) { // Stratum 0 is a kiss-o'-death
+        ntpStats.nRejected++;
+        return;
+    }
+    long long llT2 = getTimestamp(chPacket + 32); // Server received the request
+    long long llT3 = getTimestamp(chPacket + 40); // Server sent the reply
+    NtpSample &sample = samples[nSamples++];
+    sample.llOffsetUs = ((llT2 - s.llT1) + (llT3 - llT4)) / 2;
+    sample.llDelayUs = (llT4 - s.llT1) - (llT3 - llT2);
+    if (sample.llDelayUs < 0) {
+        sample.llDelayUs = 0;                    // Clock resolution of the server
+    }
+    sample.nServer = nServer;
+    sample.nStratum = nStratum;
+    ntpStats.nReplies++;
+}
+
+static long long absMicros(long long llMicros) {
+    return llMicros < 0 ? -llMicros : llMicros;
+}
+
+// From three samples on, those further from the median offset than NTP_OUTLIER_US
+// plus half their delay are dropped. Two samples must agree within NTP_OUTLIER_US
+// plus half of both delays, otherwise there is no telling which one is wrong and
+// none is taken. Of the rest the one with the least delay is taken, its offset
+// is off by at most half of it.
+static int selectSample() {
+    bool bKeep[NTP_MAX_SERVERS];
+    for (int i = 0; i < nSamples; i++) {
+        bKeep[i] = true;
+    }
+    if (nSamples >= 3) {
+        long long llSorted[NTP_MAX_SERVERS];
+        for (int i = 0; i < nSamples; i++) {
+            int j = i;
+            for (; j > 0 && llSorted[j - 1] > samples[i].llOffsetUs; j--) {
+                llSorted[j] = llSorted[j - 1];
+            }
+            llSorted[j] = samples[i].llOffsetUs;
+        }
+        long long llMedian = nSamples % 2 ? llSorted[nSamples / 2]
+                                          : (llSorted[nSamples / 2 - 1] + llSorted[nSamples / 2]) / 2;
+        for (int i = 0; i < nSamples; i++) {
+            if (absMicros(samples[i].llOffsetUs - llMedian) > NTP_OUTLIER_US + samples[i].llDelayUs / 2) {
+                bKeep[i] = false;
+                ntpStats.nOutliers++;
+            }
+        }
+    } else if (nSamples == 2) {
+        if (absMicros(samples[0].llOffsetUs - samples[1].llOffsetUs) >
+            NTP_OUTLIER_US + (samples[0].llDelayUs + samples[1].llDelayUs) / 2) {
+            ntpStats.nDisagreed++;
+            return -1;
+        }
+    }
+    int nBest = -1;
+    for (int i = 0; i < nSamples; i++) {
+        if (bKeep[i] && (nBest < 0 || samples[i].llDelayUs < samples[nBest].llDelayUs)) {
+            nBest = i;
+        }
+    }
+    return nBest;
+}
+
+// The poll interval doubles while the offsets stay small and starts over after
+// a step. Failed rounds are retried after NTP_RETRY_S, doubling up to NTP_MAX_POLL_S.
+static void finishRound() {
+    bRoundOpen = false;
+    for (int i = 0; i < nServers; i++) {
+        if (servers[i].bPending) {
+            servers[i].bPending = false;
+            ntpStats.nTimeouts++;
+        }
+    }
+    int nBest = selectSample();
+    if (nBest < 0) {
+        ntpStats.nFailedRounds++;
+        ulRetryS = ulRetryS ? min(2 * ulRetryS, (unsigned long)NTP_MAX_POLL_S) : NTP_RETRY_S;
+        ulNextRound = millis() + ulRetryS * 1000;
+        Serial.printf("NTP clock: %s, retry in %lu s\n", nSamples ? "replies disagree" : "no usable reply", ulRetryS);
+        return;
+    }
+    ulRetryS = 0;
+
+    const NtpSample &best = samples[nBest];
+    bool bStep = !bSynced || absMicros(best.llOffsetUs) >= NTP_STEP_US;
+    if (bStep) {
+        struct timeval tv;
+        long long llNow = localMicros() + best.llOffsetUs;
+        tv.tv_sec = llNow / 1000000;
+        tv.tv_usec = llNow % 1000000;
+        ntpClockStep(&tv);
+        ntpStats.nSteps++;
+        ntpStats.ulPollS = NTP_MIN_POLL_S;
+    } else {
+        struct timeval delta;
+        delta.tv_sec = best.llOffsetUs / 1000000;
+        delta.tv_usec = best.llOffsetUs % 1000000;
+        ntpClockSlew(&delta);
+        ntpStats.nSlews++;
+        if (absMicros(best.llOffsetUs) < NTP_STEADY_US) {
+            ntpStats.ulPollS = min(2 * ntpStats.ulPollS, (unsigned long)NTP_MAX_POLL_S);
+        }
+    }
+    bSynced = true;
+
+    ntpStats.llOffsetUs = best.llOffsetUs;
+    ntpStats.lDelayUs = best.llDelayUs;
+    ntpStats.nStratum = best.nStratum;
+    ntpStats.ipServer = servers[best.nServer].ip;
+    ntpStats.ulSyncMillis = millis();
+    ulNextRound = millis() + ntpStats.ulPollS * 1000;
+    IPAddress &ip = ntpStats.ipServer;
+    Serial.printf("NTP clock: %s %+lld us, delay %ld us, %d.%d.%d.%d stratum %d, %d replies, next in %lu s\n",
+                  bStep ? "stepped" : "slewing", ntpStats.llOffsetUs, ntpStats.lDelayUs,
+                  ip[0], ip[1], ip[2], ip[3], ntpStats.nStratum, nSamples, ntpStats.ulPollS);
+}
+
+void ntpLoop() {
+    if (bRoundOpen) {
+        int nLength;
+        while ((nLength = ntpUdp.parsePacket()) > 0) {
+            receiveReply(nLength);
+        }
+        bool bPending = false;
+        for (int i = 0; i < nServers; i++) {
+            bPending |= servers[i].bPending;
+        }
+        if (!bPending || millis() - ulRoundStart >= NTP_REPLY_TIMEOUT_MS) {
+            finishRound();
+        }
+    } else {
+        while (ntpUdp.parsePacket() > 0) {      // Replies after the timeout
+            ntpUdp.flush();
+            ntpStats.nRejected++;
+        }
+        if ((long)(millis() - ulNextRound) >= 0) {
+            startRound();
+        }
+    }
+}
+
+unsigned long ntpMsToNextEvent() {
+    if (bRoundOpen) {
+        return 1;                                // Replies are timestamped when they are read
+    }
+    long lWait = (long)(ulNextRound - millis());
+    return lWait > 0 ? lWait : 0;
+}
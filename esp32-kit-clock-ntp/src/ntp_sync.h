@@ -0,0 +1,70 @@
+#ifndef NTP_SYNC_H
+#define NTP_SYNC_H
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// NTP synchronization: every poll round asks all configured servers at once,
+// computes offset and round-trip delay of each reply from the four timestamps,
+// drops replies far from the median offset and corrects the system clock with
+// the one of least delay. Small corrections are slewed, large ones stepped.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <sys/time.h>
+
+// Comma separated "host" or "host:port" entries, each resolved again every round
+#ifndef NTP_SERVERS
+#define NTP_SERVERS "0.pool.ntp.org,1.pool.ntp.org,2.pool.ntp.org,3.pool.ntp.org"
+#endif
+#ifndef NTP_MIN_POLL_S
+#define NTP_MIN_POLL_S 64            // Poll interval after a step or at start
+#endif
+#ifndef NTP_MAX_POLL_S
+#define NTP_MAX_POLL_S 1024          // Longest poll interval, also for retries
+#endif
+#ifndef NTP_RETRY_S
+#define NTP_RETRY_S 2                // First retry after a round without a usable reply, doubles
+#endif
+#define NTP_MAX_SERVERS 4            // Servers asked per round
+#define NTP_LOCAL_PORT 4000          // UDP port the requests are sent from
+#define NTP_REPLY_TIMEOUT_MS 1000    // A round waits this long for replies
+#define NTP_STEP_US 128000           // Offsets from this on are stepped, below slewed
+#define NTP_STEADY_US 5000           // Offsets below this double the poll interval
+#define NTP_OUTLIER_US 20000         // Allowed distance from the median offset, plus half the delay
+
+struct NtpStats {
+    unsigned long nRounds;           // Poll rounds started
+    unsigned long nFailedRounds;     // Rounds without a usable reply, or with two that disagree
+    unsigned long nDnsFailures;      // Server names that did not resolve
+    unsigned long nRequests;         // Requests sent
+    unsigned long nReplies;          // Valid replies
+    unsigned long nRejected;         // Replies dropped: no matching request, unsynchronized server, kiss-o'-death
+    unsigned long nTimeouts;         // Requests left without a reply
+    unsigned long nOutliers;         // Valid replies too far from the median offset of their round
+    unsigned long nDisagreed;        // Rounds with two replies too far apart to take either
+    unsigned long nSteps;            // Clock set with settimeofday()
+    unsigned long nSlews;            // Clock corrected with adjtime()
+    long long llOffsetUs;            // Last correction, positive when the clock was behind
+    long lDelayUs;                   // Round-trip delay of the reply it was taken from
+    int nStratum;                    // Stratum of that server
+    IPAddress ipServer;              // That server
+    unsigned long ulSyncMillis;      // millis() of the last correction, 0 before the first
+    unsigned long ulPollS;           // Poll interval in use
+};
+
+extern NtpStats ntpStats;
+
+void ntpBegin(const char *chServers);    // Sets the server list and starts the first round
+void ntpLoop();                          // Sends, receives and applies; call from loop(), does not wait
+bool ntpSynced();                        // The clock has been set at least once
+unsigned long ntpMsToNextEvent();        // How long loop() may sleep without delaying NTP
+
+// System clock access. The ESP32 versions use gettimeofday(), settimeofday()
+// and adjtime(); the native build replaces them with a simulated clock.
+void ntpClockGet(struct timeval *tv);
+void ntpClockStep(const struct timeval *tv);
+void ntpClockSlew(const struct timeval *delta);
+
+#endif
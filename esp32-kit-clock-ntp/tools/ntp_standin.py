@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""NTP server stand-in for testing ntp_sync against, see native/main.cpp.
+
+Answers NTP client requests with the clock of this computer plus --offset.
+Requests and replies are held back for --delay ms each way, replies for up to
+--jitter ms more. Run several on different ports to have several servers, one
+with a large --offset is a falseticker the clock has to reject.
+
+usage: ntp_standin.py [--port N] [--offset MS] [--delay MS] [--jitter MS]
+                      [--stratum N] [--drop FRACTION]
+"""
+
+import argparse
+import heapq
+import random
+import select
+import socket
+import struct
+import time
+
+NTP_UNIX_OFFSET = 2208988800
+
+
+def timestamp(seconds):
+    """NTP timestamp of a Unix time, era 0 and 1 alike."""
+    seconds += NTP_UNIX_OFFSET
+    whole = int(seconds)
+    return struct.pack("!II", whole & 0xFFFFFFFF, int((seconds - whole) * 2**32) & 0xFFFFFFFF)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=12300)
+    parser.add_argument("--offset", type=float, default=0, help="ms the served time is ahead")
+    parser.add_argument("--delay", type=float, default=0, help="ms each way")
+    parser.add_argument("--jitter", type=float, default=0, help="up to ms more on the way back")
+    parser.add_argument("--stratum", type=int, default=2, help="0 sends kiss-o'-death replies")
+    parser.add_argument("--drop", type=float, default=0, help="fraction of requests not answered")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", args.port))
+    print(f"ntp stand-in on 127.0.0.1:{args.port}, offset {args.offset:+g} ms, "
+          f"delay {args.delay:g} ms, jitter {args.jitter:g} ms, stratum {args.stratum}", flush=True)
+
+    def served(mono):
+        # The time of this computer at monotonic time mono, plus the offset
+        return time.time() + (mono - time.monotonic()) + args.offset / 1000
+
+    pending = []  # (monotonic due, sequence, event, ...)
+    sequence = 0
+    while True:
+        timeout = max(0, pending[0][0] - time.monotonic()) if pending else None
+        if select.select([sock], [], [], timeout)[0]:
+            request, client = sock.recvfrom(512)
+            if len(request) >= 48 and request[0] & 7 == 3 and random.random() >= args.drop:
+                heapq.heappush(pending, (time.monotonic() + args.delay / 1000, sequence, "arrive", request, client))
+                sequence += 1
+        now = time.monotonic()
+        while pending and pending[0][0] <= now:
+            due, _, event, data, client = heapq.heappop(pending)
+            if event == "arrive":
+                # Receive and transmit timestamps are taken as the request "arrives"
+                received = served(due)
+                reply = bytearray(48)
+                reply[0] = 0x24 if args.stratum else 0xE4  # Version 4, mode 4, leap 3 if unsynchronized
+                reply[1] = args.stratum
+                reply[2] = data[2]
+                reply[3] = 0xEC  # Precision 2^-20 s
+                reply[12:16] = b"LOCL" if args.stratum else b"RATE"
+                reply[16:24] = timestamp(received)
+                reply[24:32] = data[40:48]  # Origin: the transmit timestamp of the request
+                reply[32:40] = timestamp(received)
+                reply[40:48] = timestamp(served(time.monotonic()))
+                back = args.delay + random.uniform(0, args.jitter)
+                heapq.heappush(pending, (time.monotonic() + back / 1000, sequence, "send", bytes(reply), client))
+                sequence += 1
+            else:
+                sock.sendto(data, client)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass